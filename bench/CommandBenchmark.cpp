@@ -0,0 +1,250 @@
+// Load generator for the network and dispatch path.
+//
+// A local WebSocketServer stands in for the controller and floods commands at the real client stack
+// (WebSocketClient -> CommandRouter -> RigRegistry on fake or real GPIO). Every command carries its sequence
+// number after the value, which the parser ignores, so the end-to-end latency from send to dispatched can be
+// matched up without relying on in-order, loss free delivery.
+//
+// With --direct the generator dispatches into the router itself, which leaves the parse and dispatch cost
+// without the network stack for comparison.
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include <boost/program_options.hpp>
+
+#include "Client.hpp"
+#include "CommandRouter.hpp"
+#include "LatencyHistogram.hpp"
+#include "LatencyMonitor.hpp"
+#include "Logger.hpp"
+#include "RigRegistry.hpp"
+#include "Server.hpp"
+#include "Trace.hpp"
+
+namespace po = boost::program_options;
+
+// opcode with its share of the generated load
+struct MixEntry
+{
+    char code;
+    unsigned weight;
+};
+
+// parse "p=50,y=30,f=10,i=10"
+static std::vector<MixEntry> parseMix(const std::string& spec)
+{
+    std::vector<MixEntry> mix;
+    std::istringstream in(spec);
+    std::string item;
+
+    while(std::getline(in, item, ','))
+    {
+        if(item.size() < 3 || item[1] != '=' || !CommandRouter::isRegistered(item[0]))
+            throw std::invalid_argument("invalid mix entry '" + item + "'");
+
+        mix.push_back(MixEntry{item[0], static_cast<unsigned>(std::stoul(item.substr(2)))});
+    }
+
+    if(mix.empty())
+        throw std::invalid_argument("empty command mix");
+
+    return mix;
+}
+
+// one realistic argument for the opcode
+static int randomValue(char code, std::mt19937& rng)
+{
+    switch(code)
+    {
+        case 'p':
+        case 'y':
+            return std::uniform_int_distribution<int>(-100, 100)(rng);
+        case 'f':
+        case 'z':
+            return std::uniform_int_distribution<int>(0, 2)(rng);
+        default:
+            return std::uniform_int_distribution<int>(0, 1)(rng);
+    }
+}
+
+// user plus system time of the whole process
+static double processCpuSeconds()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        po::options_description desc("Options");
+        desc.add_options()
+            ("help,h", "Show this help")
+            ("port", po::value<uint16_t>()->default_value(19876), "Local port of the stand-in controller")
+            ("rate", po::value<unsigned>()->default_value(1000), "Commands per second, 0 floods as fast as possible")
+            ("duration", po::value<double>()->default_value(5.0), "Seconds of load")
+            ("mix", po::value<std::string>()->default_value("p=45,y=45,f=4,z=4,i=2"), "Opcode weights")
+            ("send-queue", po::value<size_t>()->default_value(4096), "Send queue of the stand-in controller")
+            ("send-policy", po::value<std::string>()->default_value("drop-oldest"), "\"drop-oldest\", \"drop-newest\" or \"coalesce\"")
+            ("direct", "Dispatch on the generator thread without the websocket stack")
+            ("trace", po::value<std::string>(), "Write the timing spans of the run as Chrome trace-event JSON to this file");
+
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+
+        if(vm.count("help"))
+        {
+            std::cout << desc << std::endl;
+            std::cout << "Runs against the configured GPIO, on a Pi the default rig really moves." << std::endl;
+            return 0;
+        }
+
+        Logger::instance().setLevel(Logger::Warning);
+        Trace::setEnabled(vm.count("trace") > 0);
+
+        const std::vector<MixEntry> mix = parseMix(vm["mix"].as<std::string>());
+        const unsigned rate = vm["rate"].as<unsigned>();
+        const auto duration = std::chrono::duration<double>(vm["duration"].as<double>());
+        const uint16_t port = vm["port"].as<uint16_t>();
+        const bool direct = vm.count("direct") > 0;
+
+        // weighted opcode table so picking one is a single random index
+        std::vector<char> codes;
+        for(auto& entry : mix)
+            codes.insert(codes.end(), entry.weight, entry.code);
+
+        RigRegistry rigs({RigRegistry::defaultRig()});
+        CommandRouter router(rigs);
+
+        // send stamps by sequence number, large enough that a slot is never reused while in flight
+        std::vector<std::atomic<int64_t>> sent(1 << 20);
+        LatencyHistogram latency;
+        std::atomic<uint64_t> received(0);
+
+        const CommandReply reply = [](const std::string&) {};
+
+        // what the rig does with every command that reaches it
+        const std::function<void(const std::string&)> onCommand = [&](const std::string& msg) {
+            LatencyMonitor::CommandScope command;
+            router.dispatch(msg, reply);
+
+            auto hash = msg.rfind('#');
+            if(hash == std::string::npos)
+                return;
+
+            uint64_t sequence = std::stoull(msg.substr(hash + 1));
+            int64_t stamp = sent[sequence % sent.size()].load(std::memory_order_acquire);
+
+            latency.record(static_cast<uint64_t>(LatencyMonitor::now() - stamp));
+            received.fetch_add(1, std::memory_order_relaxed);
+        };
+
+        std::unique_ptr<WebSocketServer> controller;
+        std::unique_ptr<WebSocketClient> rig;
+
+        if(!direct)
+        {
+            controller.reset(new WebSocketServer(port));
+            controller->setSendQueue(vm["send-queue"].as<size_t>(),
+                                     parseDropPolicy(vm["send-policy"].as<std::string>()), 64 * 1024 * 1024);
+
+            rig.reset(new WebSocketClient());
+            rig->setHeartbeat(std::chrono::milliseconds(0), std::chrono::milliseconds(0));
+            rig->setMessageHandler(onCommand);
+
+            std::atomic<bool> connected(false);
+            controller->onConnected.connect([&connected](websocketpp::connection_hdl) {
+                connected = true;
+            });
+
+            rig->connect("127.0.0.1", port);
+
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            while(!connected && std::chrono::steady_clock::now() < deadline)
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+            if(!connected)
+            {
+                std::cerr << "Client did not connect to the local controller on port " << port << std::endl;
+                return 1;
+            }
+        }
+
+        std::mt19937 rng(42);
+        std::uniform_int_distribution<size_t> pick(0, codes.size() - 1);
+
+        const double cpuStart = processCpuSeconds();
+        const auto start = std::chrono::steady_clock::now();
+        const auto end = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(duration);
+        uint64_t sequence = 0;
+
+        for(auto now = start; now < end; now = std::chrono::steady_clock::now())
+        {
+            if(rate > 0)
+                std::this_thread::sleep_until(start + std::chrono::nanoseconds(sequence * 1000000000ull / rate));
+
+            char code = codes[pick(rng)];
+            auto msg = std::make_shared<const std::string>(
+                    code + std::to_string(randomValue(code, rng)) + "#" + std::to_string(sequence));
+
+            sent[sequence % sent.size()].store(LatencyMonitor::now(), std::memory_order_release);
+            if(direct)
+                onCommand(*msg);
+            else
+                controller->send(msg);
+            sequence++;
+        }
+
+        const auto sendEnd = std::chrono::steady_clock::now();
+
+        // let the tail drain, dropped commands never arrive
+        auto deadline = sendEnd + std::chrono::seconds(2);
+        while(received < sequence && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const double cpu = processCpuSeconds() - cpuStart;
+        const uint64_t count = received;
+        const SendQueueStats stats = controller ? controller->getSendQueueStats() : SendQueueStats();
+
+        std::cout << "commands sent      " << sequence << " in "
+                  << std::chrono::duration<double>(sendEnd - start).count() << " s" << std::endl;
+        std::cout << "commands received  " << count << ", " << stats.dropped << " dropped by the send queue" << std::endl;
+        std::cout << "throughput         " << count / elapsed << " commands/s" << std::endl;
+        std::cout << "latency to dispatch p50 " << latency.percentile(50) / 1000.0
+                  << " us, p99 " << latency.percentile(99) / 1000.0
+                  << " us, p999 " << latency.percentile(99.9) / 1000.0
+                  << " us, max " << latency.getMax() / 1000.0 << " us" << std::endl;
+        std::cout << "cpu per command    " << (count > 0 ? cpu / count * 1e6 : 0.0)
+                  << (direct ? " us (whole process)" : " us (whole process, includes the stand-in controller)") << std::endl;
+
+        rigs.stop();
+
+        if(vm.count("trace"))
+        {
+            Trace::setEnabled(false);
+            Trace::save(vm["trace"].as<std::string>());
+        }
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
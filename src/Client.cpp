@@ -1,6 +1,26 @@
 #include "Client.hpp"
 
-WebSocketClient::WebSocketClient() : m_Running(false) {
+#include "LatencyMonitor.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+
+namespace {
+
+Metrics::Counter Reconnects("rig_reconnects_total", "Reconnect attempts scheduled after a failed or lost controller link");
+
+/// A connection that closes sooner counts as a failed attempt, so a controller that accepts and drops at once is
+/// redialed with backoff instead of in a tight loop.
+const std::chrono::seconds StableLifetime(2);
+
+}
+
+WebSocketClient::WebSocketClient()
+        : m_Preferred(0), m_Launched(0), m_Current(0), m_Stagger(100), m_HeartbeatInterval(1000), m_HeartbeatTimeout(3000), m_BackoffInitial(50), m_BackoffMax(5000),
+          m_Attempt(0), m_Random(std::random_device()()), m_Stopping(false), m_Running(false),
+          m_Work(64, DropPolicy::Coalesce), m_HighWater(64 * 1024) {
     m_Client = std::make_shared<Client>();
 
     m_Client->set_access_channels(websocketpp::log::alevel::none);
@@ -11,16 +31,30 @@ WebSocketClient::WebSocketClient() : m_Running(false) {
     m_Client->set_close_handler(bind(&WebSocketClient::onClose, this, std::placeholders::_1));
     m_Client->set_message_handler(
             bind(&WebSocketClient::onMessageReceived, this, std::placeholders::_1, std::placeholders::_2));
+    m_Client->set_pong_timeout_handler(bind(&WebSocketClient::onPongTimeout, this, std::placeholders::_1));
 
     m_Client->init_asio();
 
+    // keep the io loop alive between connections so reconnects never need a new thread
+    m_Client->start_perpetual();
+
+    m_AsioThread = std::thread([=]() {
+        Trace::setThreadName("client io");
+
+        try {
+            m_Client->run();
+        }
+        catch (std::exception &ex) {
+            Logger::error("Exception in WebSocketClient io loop: '%s'.", ex.what());
+        }
+    });
+
     m_Running = true;
 
     m_WorkerThread = std::thread([=]() {
         try {
             while (m_Running) {
-                std::shared_ptr<const std::string> message;
-                websocketpp::connection_hdl hdl;
+                Outgoing work;
 
                 {
                     std::unique_lock<std::mutex> lock(m_mutex);
@@ -31,83 +65,258 @@ WebSocketClient::WebSocketClient() : m_Running(false) {
                         break;
                     }
 
-                    auto work = m_Work[0];
-                    message = work.first;
-                    hdl = work.second;
-                    m_Work.pop_front();
+                    if (m_Work.empty()) {
+                        continue;
+                    }
+
+                    if (isCongested()) {
+                        // leave the messages in the bounded queue, its drop policy decides what survives
+                        m_not_empty.wait_for(lock, std::chrono::milliseconds(5), [this]() { return !m_Running; });
+                        continue;
+                    }
+
+                    m_Work.pop(work);
                 }
 
-                if (hdl.lock()) {
-                    auto con = m_Client->get_con_from_hdl(hdl);
-                    m_Client->send(con, *message,
-                                   websocketpp::frame::opcode::TEXT);
-                } else {
-                    m_Client->send(m_Connection, *message,
-                                   websocketpp::frame::opcode::TEXT);
+                if (!work.hdl.lock()) {
+                    work.hdl = connection();
+                }
+
+                // messages for a dropped link are discarded, the peer resyncs after reconnecting
+                if (work.hdl.lock()) {
+                    websocketpp::lib::error_code ec;
+                    m_Client->send(work.hdl, *work.message, work.opcode, ec);
                 }
             }
         }
         catch (std::exception &ex) {
-            std::cerr << "Exception in WebSocketClient: '%s'."<< ex.what() << std::endl;
+            Logger::error("Exception in WebSocketClient: '%s'.", ex.what());
         }
     });
 }
 
 bool WebSocketClient::connect(std::string address, uint16_t port) {
-    try {
-        websocketpp::lib::error_code ec;
+    return connect(std::vector<Endpoint>{Endpoint{std::move(address), port}});
+}
+
+bool WebSocketClient::connect(const std::vector<Endpoint> &endpoints) {
+    if (endpoints.empty()) {
+        Logger::error("Failed to start client, no peer given.");
+        return false;
+    }
+
+    std::vector<std::string> uris;
+
+    for (const Endpoint &endpoint : endpoints) {
         std::string uri("ws://");
-        uri += address;
+        // IPv6 literals go in brackets, the port would be taken for part of the address otherwise
+        uri += endpoint.address.find(':') != std::string::npos ? "[" + endpoint.address + "]" : endpoint.address;
         uri += ":";
-        uri += std::to_string(port);
-        auto con = m_Client->get_connection(uri, ec);
+        uri += std::to_string(endpoint.port);
 
-        if (ec) {
-            std::cerr << "Failed to start client, error = '%s'." << ec.message().c_str() << std::endl;
-            m_Connection = nullptr;
+        if (!websocketpp::uri(uri).get_valid()) {
+            Logger::error("Failed to start client, invalid uri '%s'.", uri.c_str());
             return false;
         }
 
-        m_Client->connect(con);
+        uris.push_back(uri);
+    }
+
+    m_Client->get_io_service().post([this, uris]() {
+        m_Uris = uris;
+        m_Preferred = 0;
+        m_Attempt = 0;
+        startRound();
+    });
+
+    return true;
+}
+
+void WebSocketClient::setDialStagger(std::chrono::milliseconds stagger) {
+    m_Stagger = std::max(stagger, std::chrono::milliseconds(0));
+}
+
+void WebSocketClient::setHeartbeat(std::chrono::milliseconds interval, std::chrono::milliseconds timeout) {
+    m_HeartbeatInterval = interval;
+    m_HeartbeatTimeout = timeout;
+}
 
-        if (m_AsioThread.joinable()) {
-            m_AsioThread.join();
+void WebSocketClient::setReconnectBackoff(std::chrono::milliseconds initial, std::chrono::milliseconds maximum) {
+    m_BackoffInitial = std::max(initial, std::chrono::milliseconds(1));
+    m_BackoffMax = std::max(maximum, m_BackoffInitial);
+}
+
+void WebSocketClient::setSendQueue(size_t capacity, DropPolicy policy, size_t highWater) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_Work.configure(capacity, policy);
+    m_HighWater = highWater;
+}
+
+SendQueueStats WebSocketClient::getSendQueueStats() const {
+    SendQueueStats stats;
+    stats.depth = m_Work.getDepth();
+    stats.dropped = m_Work.getDropped();
+    return stats;
+}
+
+bool WebSocketClient::isCongested() {
+    websocketpp::lib::error_code ec;
+    auto con = m_Client->get_con_from_hdl(connection(), ec);
+    return !ec && con && con->get_buffered_amount() > m_HighWater;
+}
+
+bool WebSocketClient::isConnected() {
+    return !connection().expired();
+}
+
+std::string WebSocketClient::getEndpoint() {
+    std::lock_guard<std::mutex> lock(m_ConnectionMutex);
+    return m_Connection.expired() ? std::string() : m_Endpoint;
+}
+
+websocketpp::lib::asio::io_service &WebSocketClient::getIoService() {
+    return m_Client->get_io_service();
+}
+
+websocketpp::connection_hdl WebSocketClient::connection() {
+    std::lock_guard<std::mutex> lock(m_ConnectionMutex);
+    return m_Connection;
+}
+
+void WebSocketClient::startRound() {
+    m_Launched = 0;
+    dialNext();
+}
+
+void WebSocketClient::dialNext() {
+    if (m_StaggerTimer) {
+        m_StaggerTimer->cancel();
+        m_StaggerTimer.reset();
+    }
+
+    while (!m_Stopping && !isConnected() && m_Launched < m_Uris.size()) {
+        size_t index = (m_Preferred + m_Launched++) % m_Uris.size();
+
+        if (!dial(index)) {
+            continue;
         }
 
-        m_AsioThread = std::thread([=]() {
-            m_Client->run();
-        });
+        // the next peer only waits for a slow attempt, a refused one hands over through onFail right away
+        if (m_Launched < m_Uris.size()) {
+            m_StaggerTimer = m_Client->set_timer(m_Stagger.count(), [this](websocketpp::lib::error_code const &ec) {
+                if (!ec) {
+                    dialNext();
+                }
+            });
+        }
+        return;
     }
-    catch (std::exception &ex) {
-        std::cerr << "Failed to open client, error = '%s'." << ex.what() << std::endl;
+
+    // every peer of the round failed
+    if (!m_Stopping && !isConnected() && m_Dialing.empty()) {
+        scheduleReconnect();
+    }
+}
+
+bool WebSocketClient::dial(size_t index) {
+    websocketpp::lib::error_code ec;
+    auto con = m_Client->get_connection(m_Uris[index], ec);
+
+    if (ec) {
+        Logger::error("Failed to dial '%s', error = '%s'.", m_Uris[index].c_str(), ec.message().c_str());
         return false;
     }
 
+    if (m_HeartbeatInterval.count() > 0) {
+        // a dead link must not hold us in a close handshake longer than the heartbeat allows
+        con->set_pong_timeout(m_HeartbeatTimeout.count());
+        con->set_close_handshake_timeout(m_HeartbeatTimeout.count());
+    }
+
+    m_Dialing[con->get_handle()] = index;
+    m_Client->connect(con);
     return true;
 }
 
+void WebSocketClient::scheduleReconnect() {
+    if (m_Stopping) {
+        return;
+    }
+
+    Reconnects.add();
+
+    // exponential backoff, jittered so a fleet of rigs does not reconnect in lockstep
+    auto delay = m_BackoffInitial * (1u << std::min(m_Attempt, 16u));
+    delay = std::min(delay, m_BackoffMax);
+    m_Attempt++;
+
+    std::uniform_int_distribution<long> jitter(std::max<long>(delay.count() / 2, 1), delay.count());
+
+    m_ReconnectTimer = m_Client->set_timer(jitter(m_Random), [this](websocketpp::lib::error_code const &ec) {
+        if (!ec) {
+            startRound();
+        }
+    });
+}
+
+void WebSocketClient::heartbeat(websocketpp::connection_hdl hdl) {
+    if (m_Stopping || m_HeartbeatInterval.count() <= 0) {
+        return;
+    }
+
+    m_HeartbeatTimer = m_Client->set_timer(m_HeartbeatInterval.count(),
+                                           [this, hdl](websocketpp::lib::error_code const &ec) {
+        if (ec || hdl.expired()) {
+            return;
+        }
+
+        websocketpp::lib::error_code pingEc;
+        m_Client->ping(hdl, "", pingEc);
+
+        // a failed ping means the connection is already going down, onClose takes over
+        if (!pingEc) {
+            heartbeat(hdl);
+        }
+    });
+}
 
 WebSocketClient::~WebSocketClient() {
     m_Running = false;
+    m_not_empty.notify_one();
 
     if (m_WorkerThread.joinable()) {
         m_WorkerThread.join();
     }
 
-    try {
-        websocketpp::lib::error_code ec;
-        m_Client->pause_reading(m_Connection);
-        m_Client->close(m_Connection, websocketpp::close::status::going_away, "", ec);
+    m_Stopping = true;
 
-        if (ec) {
-            std::cerr << "Failed to shutdown connection, error = '%s'." << ec.message().c_str() << std::endl;
+    // timers and the connection belong to the asio thread, shut them down there
+    m_Client->get_io_service().post([this]() {
+        if (m_ReconnectTimer) {
+            m_ReconnectTimer->cancel();
         }
-    }
-    catch (std::exception &ex) {
-        std::cerr << "Failed to shutdown connection, error = '%s'." << ex.what() << std::endl;
-    }
 
-    m_Connection.reset();
+        if (m_StaggerTimer) {
+            m_StaggerTimer->cancel();
+        }
+
+        if (m_HeartbeatTimer) {
+            m_HeartbeatTimer->cancel();
+        }
+
+        auto hdl = connection();
+
+        if (!hdl.expired()) {
+            websocketpp::lib::error_code ec;
+            m_Client->close(hdl, websocketpp::close::status::going_away, "", ec);
+
+            if (ec) {
+                Logger::error("Failed to shutdown connection, error = '%s'.", ec.message().c_str());
+            }
+        }
+
+        m_Client->stop_perpetual();
+    });
 
     if (m_AsioThread.joinable()) {
         m_AsioThread.join();
@@ -120,59 +329,142 @@ void WebSocketClient::send(const std::string &message, websocketpp::connection_h
     }
 }
 
-void WebSocketClient::send(std::shared_ptr<const std::string> message, websocketpp::connection_hdl hdl) {
+void WebSocketClient::send(std::shared_ptr<const std::string> message, websocketpp::connection_hdl hdl,
+                           websocketpp::frame::opcode::value opcode, int key) {
     if (message && !message->empty()) {
         std::unique_lock<std::mutex> lock(m_mutex);
-        m_Work.push_back(std::make_pair(message, hdl));
+        m_Work.push(Outgoing{std::move(message), hdl, opcode}, key);
         lock.unlock();
         m_not_empty.notify_one();
     }
 }
 
 void WebSocketClient::onOpen(websocketpp::connection_hdl hdl) {
-    try {
-        // make sure to only fire onConnected one time for a connection
-        bool newConnection = !m_Connection;
-        m_Connection = m_Client->get_con_from_hdl(hdl);
+    auto dialing = m_Dialing.find(hdl);
+    size_t index = dialing != m_Dialing.end() ? dialing->second : 0;
 
-        if (newConnection) {
-            onConnected();
-        }
+    if (dialing != m_Dialing.end()) {
+        m_Dialing.erase(dialing);
+    }
+
+    if (m_Stopping || isConnected()) {
+        // lost the race against another peer, its onClose finds it is not the open connection
+        websocketpp::lib::error_code ec;
+        m_Client->close(hdl, websocketpp::close::status::going_away, "", ec);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_ConnectionMutex);
+        m_Connection = hdl;
+        m_Endpoint = m_Uris[index];
+    }
+
+    // the round is won, attempts still in flight are closed as they open
+    m_Current = index;
+    m_Launched = m_Uris.size();
+
+    if (m_StaggerTimer) {
+        m_StaggerTimer->cancel();
+    }
+
+    if (m_ReconnectTimer) {
+        m_ReconnectTimer->cancel();
+    }
+
+    // the backoff only starts over once the connection has held for StableLifetime, see onClose
+    m_OpenedAt = std::chrono::steady_clock::now();
+    heartbeat(hdl);
+
+    try {
+        onConnected();
     }
     catch (std::exception &ex) {
-        std::cerr << "Failed during onConnected, error '%s'." << ex.what() << std::endl;
+        Logger::error("Failed during onConnected, error '%s'.", ex.what());
     }
 }
 
 void WebSocketClient::onFail(websocketpp::connection_hdl hdl) {
-    m_Running = false;
+    Client::connection_ptr con = m_Client->get_con_from_hdl(hdl);
+    std::string error_message = con->get_ec().message();
 
-    if (m_WorkerThread.joinable()) {
-        m_WorkerThread.join();
+    auto dialing = m_Dialing.find(hdl);
+    if (dialing == m_Dialing.end()) {
+        return;
     }
 
-    Client::connection_ptr con = m_Client->get_con_from_hdl(hdl);
-    std::string error_message = con->get_ec().message();
-    std::cerr << "Failed while trying to connect. %s" << error_message.c_str() << std::endl;
+    Logger::warning("Failed while trying to connect to '%s', error '%s'.", m_Uris[dialing->second].c_str(),
+                    error_message.c_str());
+    m_Dialing.erase(dialing);
+
+    dialNext();
 }
 
 void WebSocketClient::onClose(websocketpp::connection_hdl hdl) {
-    m_Running = false;
+    {
+        std::lock_guard<std::mutex> lock(m_ConnectionMutex);
 
-    if (m_WorkerThread.joinable()) {
-        m_WorkerThread.join();
+        // a peer that lost the dialing race
+        if (m_Connection.owner_before(hdl) || hdl.owner_before(m_Connection)) {
+            return;
+        }
+
+        m_Connection.reset();
+    }
+
+    try {
+        onDisconnected();
+    }
+    catch (std::exception &ex) {
+        Logger::error("Failed during onDisconnected, error '%s'.", ex.what());
+    }
+
+    bool stable = std::chrono::steady_clock::now() - m_OpenedAt >= StableLifetime;
+
+    if (stable) {
+        m_Attempt = 0;
+    }
+
+    // fail over at once, the lost peer is dialed last; a single peer, or one that dropped us right after the
+    // handshake, waits out the backoff instead
+    m_Preferred = (m_Current + 1) % m_Uris.size();
+
+    if (stable && m_Uris.size() > 1) {
+        Reconnects.add();
+        startRound();
+    } else {
+        scheduleReconnect();
     }
 }
 
-void WebSocketClient::onMessageReceived(websocketpp::connection_hdl hdl, Client::message_ptr msg) {
+void WebSocketClient::onPongTimeout(websocketpp::connection_hdl hdl) {
+    Logger::warning("Heartbeat timed out, dropping connection.");
+
+    // the close handshake is bounded by the heartbeat timeout, onClose reconnects afterwards
+    websocketpp::lib::error_code ec;
+    m_Client->close(hdl, websocketpp::close::status::going_away, "heartbeat timeout", ec);
+}
+
+void WebSocketClient::onMessageReceived(websocketpp::connection_hdl, Client::message_ptr msg) {
+    LatencyMonitor::CommandScope command;
+    Trace::Span span("receive", "net");
+
     try {
-        onMessage(msg->get_payload());
+        if (m_MessageHandler) {
+            m_MessageHandler(msg->get_payload());
+        }
     }
     catch (std::exception &ex) {
-        std::cerr << "Failed during onMessage, error '%s'." << ex.what() << std::endl;
+        Logger::error("Failed during onMessage, error '%s'.", ex.what());
     }
 }
 
+void WebSocketClient::setMessageHandler(MessageHandler handler) {
+    m_Client->get_io_service().post([this, handler]() {
+        m_MessageHandler = handler;
+    });
+}
+
 void WebSocketClient::setMaxMessageSize(size_t newSize) {
     if (!m_Client)
         return;
@@ -2,10 +2,18 @@
 
 #include <boost/signals2/signal.hpp>
 
+#include "SendQueue.hpp"
+
 #include <memory>
 #include <string>
+#include <functional>
+#include <map>
 #include <set>
+#include <vector>
+#include <random>
 
+#include <atomic>
+#include <chrono>
 #include <thread>
 #include <condition_variable>
 #include <mutex>
@@ -19,24 +27,72 @@
 
 #pragma warning(pop)
 
-/// Simple tcp connection class that will keep a connection as long it lives and sent and receive asynchronous messages
+/// Simple tcp connection class that will keep a connection as long it lives and sent and receive asynchronous messages.
+/// Several peers can be given, they are dialed in parallel and the first to complete the handshake wins.
+/// A dropped connection fails over to the next peer, a round in which no peer answers is redialed with a jittered
+/// exponential backoff.
 class WebSocketClient {
 public:
+    /// One peer, an IPv6 address needs no brackets.
+    struct Endpoint {
+        std::string address;
+        uint16_t port;
+    };
+
     WebSocketClient();
 
     ~WebSocketClient();
 
-    // asynchronous try to connect
+    /// Asynchronous connect to the given peer and keep reconnecting until the client is destroyed.
+    /// @return false if no valid uri can be built from address and port.
     bool connect(std::string address, uint16_t port);
 
-    /// A message has been received.
-    /// The message itself is passed a std::string even if the message is binary object.
-    boost::signals2::signal<void(const std::string &)> onMessage;
+    /// Asynchronous connect to the first of the peers that answers and keep reconnecting until the client is
+    /// destroyed. Each round starts with the preferred peer, the others follow one stagger delay apart or as soon
+    /// as the attempt before them fails, and all race on the io loop.
+    /// @return false if the list is empty or no valid uri can be built for one of the peers.
+    bool connect(const std::vector<Endpoint> &endpoints);
+
+    /// Head start of each peer over the next one in a dialing round, zero dials all at once. Call before connect().
+    void setDialStagger(std::chrono::milliseconds stagger);
+
+    /// Ping the peer every interval and drop the connection if a pong does not arrive within timeout.
+    /// A zero interval disables heartbeats. Call before connect().
+    void setHeartbeat(std::chrono::milliseconds interval, std::chrono::milliseconds timeout);
+
+    /// Reconnect delay starts at initial and doubles per failed attempt up to maximum, a connection that closes
+    /// within two seconds of opening counts as failed.
+    /// Each delay is jittered between half and the full value. Call before connect().
+    void setReconnectBackoff(std::chrono::milliseconds initial, std::chrono::milliseconds maximum);
+
+    /// Bound the send queue. When it is full the policy decides which message goes.
+    /// Messages stay queued while the socket has more than highWater bytes unsent. Call before connect().
+    void setSendQueue(size_t capacity, DropPolicy policy, size_t highWater);
+
+    /// Current depth and drop count of the send queue.
+    SendQueueStats getSendQueueStats() const;
+
+    /// True while a connection is open.
+    bool isConnected();
 
-    /// A client has connected.
-    /// The connection handle is passed as first argument.
+    /// Uri of the peer the open connection goes to, empty while there is none.
+    std::string getEndpoint();
+
+    /// The io loop all connection handlers run on, for sharing with other asio sockets.
+    websocketpp::lib::asio::io_service &getIoService();
+
+    /// Called for every received message, the message itself is passed a std::string even if it is binary.
+    typedef std::function<void(const std::string &)> MessageHandler;
+
+    /// Install the message handler. Runs on the io thread and is called directly, without the locking of a signal.
+    void setMessageHandler(MessageHandler handler);
+
+    /// A connection has been opened. Fired again after every successful reconnect.
     boost::signals2::signal<void()> onConnected;
 
+    /// The open connection has been closed or timed out.
+    boost::signals2::signal<void()> onDisconnected;
+
     /// Send a message to all registered connections.
     /// @param message Message to send.
     /// @param hdl If not empty the message will only be sent to this connection.
@@ -45,8 +101,12 @@ public:
     /// Send a message to all registered connections.
     /// @param message Message to send.
     /// @param hdl If not empty the message will only be sent to this connection.
+    /// @param opcode Frame type, binary for encoded payloads.
+    /// @param key Messages with the same key coalesce in the queue under DropPolicy::Coalesce.
     void send(std::shared_ptr<const std::string> message,
-              websocketpp::connection_hdl hdl = websocketpp::connection_hdl());
+              websocketpp::connection_hdl hdl = websocketpp::connection_hdl(),
+              websocketpp::frame::opcode::value opcode = websocketpp::frame::opcode::TEXT,
+              int key = NoSendKey);
     void setMaxMessageSize(size_t newSize);
 
 private:
@@ -64,17 +124,93 @@ private:
     /// Called on a received message.
     virtual void onMessageReceived(websocketpp::connection_hdl hdl, Client::message_ptr msg);
 
+    /// Called when a ping was not answered in time.
+    void onPongTimeout(websocketpp::connection_hdl hdl);
+
+    /// Dial all peers, starting with m_Preferred. Runs on the asio thread.
+    void startRound();
+
+    /// Dial the next peer of the round, or back off if the round is over and nothing is left in flight.
+    /// Runs on the asio thread.
+    void dialNext();
+
+    /// Start a connection attempt to the peer at index. Runs on the asio thread.
+    /// @return false if the attempt could not be started.
+    bool dial(size_t index);
+
+    /// Schedule the next dialing round. Runs on the asio thread.
+    void scheduleReconnect();
+
+    /// Send a ping after the heartbeat interval and rearm. Runs on the asio thread.
+    void heartbeat(websocketpp::connection_hdl hdl);
+
+    /// Currently open connection or an empty handle.
+    websocketpp::connection_hdl connection();
+
+    /// True if the open connection has more than m_HighWater bytes waiting for the socket.
+    bool isCongested();
+
 private:
-    Client::connection_ptr m_Connection;
+    /// Currently open connection and its peer uri, guarded by m_ConnectionMutex.
+    websocketpp::connection_hdl m_Connection;
+    std::string m_Endpoint;
+    std::mutex m_ConnectionMutex;
 
     /// WebSocket server.
     std::shared_ptr<Client> m_Client;
 
+    /// Peer uris in the order given, only used on the asio thread like the members down to m_StaggerTimer.
+    std::vector<std::string> m_Uris;
+
+    /// Peer the next round dials first.
+    size_t m_Preferred;
+
+    /// Peers dialed so far in the current round.
+    size_t m_Launched;
+
+    /// Peer of the open connection.
+    size_t m_Current;
+
+    /// Attempts that have neither opened nor failed yet, with their peer.
+    std::map<websocketpp::connection_hdl, size_t, std::owner_less<websocketpp::connection_hdl>> m_Dialing;
+
+    std::chrono::milliseconds m_Stagger;
+    Client::timer_ptr m_StaggerTimer;
+
+    std::chrono::milliseconds m_HeartbeatInterval;
+    std::chrono::milliseconds m_HeartbeatTimeout;
+    std::chrono::milliseconds m_BackoffInitial;
+    std::chrono::milliseconds m_BackoffMax;
+
+    /// Failed attempts since the last connection that stayed open for a while, short lived ones count as failed.
+    unsigned m_Attempt;
+    /// When the open connection was established.
+    std::chrono::steady_clock::time_point m_OpenedAt;
+    std::mt19937 m_Random;
+
+    Client::timer_ptr m_ReconnectTimer;
+    Client::timer_ptr m_HeartbeatTimer;
+
+    /// Set on destruction, no new timers or connection attempts after that.
+    std::atomic<bool> m_Stopping;
+
+    /// Only touched on the io thread.
+    MessageHandler m_MessageHandler;
+
     std::atomic<bool> m_Running;
-    std::mutex m_mutex;
+    mutable std::mutex m_mutex;
     std::condition_variable m_not_empty;
-    /// Queue for send
-    std::deque<std::pair<std::shared_ptr<const std::string>, websocketpp::connection_hdl>> m_Work;
+    /// Queued message with its target and frame type.
+    struct Outgoing {
+        std::shared_ptr<const std::string> message;
+        websocketpp::connection_hdl hdl;
+        websocketpp::frame::opcode::value opcode;
+    };
+
+    /// Bounded queue for send, guarded by m_mutex
+    SendQueue<Outgoing> m_Work;
+    /// Unsent bytes in websocketpp above which messages wait in m_Work.
+    size_t m_HighWater;
     /// Worker thread
     std::thread m_WorkerThread;
 
@@ -83,4 +219,4 @@ private:
     bool has_new_data() const {
         return !m_Work.empty() || !m_Running;
     }
-};
\ No newline at end of file
+};
@@ -0,0 +1,35 @@
+#include "Clock.hpp"
+
+#include <thread>
+
+std::shared_ptr<Clock> Clock::system() {
+    static std::shared_ptr<Clock> clock = std::make_shared<SystemClock>();
+    return clock;
+}
+
+Clock::time_point SystemClock::now() const {
+    return std::chrono::steady_clock::now();
+}
+
+void SystemClock::sleepUntil(time_point deadline) {
+    std::this_thread::sleep_until(deadline);
+}
+
+SimulatedClock::SimulatedClock() : m_Now(0) {
+}
+
+Clock::time_point SimulatedClock::now() const {
+    return time_point(duration(m_Now.load(std::memory_order_acquire)));
+}
+
+void SimulatedClock::sleepUntil(time_point deadline) {
+    advanceTo(deadline);
+}
+
+void SimulatedClock::advanceTo(time_point deadline) {
+    duration::rep target = deadline.time_since_epoch().count();
+    duration::rep current = m_Now.load(std::memory_order_relaxed);
+
+    while (target > current && !m_Now.compare_exchange_weak(current, target, std::memory_order_acq_rel)) {
+    }
+}
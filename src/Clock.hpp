@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+/// Time source for motion and lens timing, so the same code runs against the wall clock on the rig
+/// and against a simulated clock that jumps straight to the next deadline.
+class Clock {
+public:
+    typedef std::chrono::steady_clock::duration duration;
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    virtual ~Clock() = default;
+
+    virtual time_point now() const = 0;
+
+    /// Return once the clock reached deadline. A simulated clock advances to it instead of waiting.
+    virtual void sleepUntil(time_point deadline) = 0;
+
+    void sleepFor(duration interval) {
+        sleepUntil(now() + interval);
+    }
+
+    /// True if time only moves when somebody advances it.
+    virtual bool isSimulated() const = 0;
+
+    /// Shared wall clock instance.
+    static std::shared_ptr<Clock> system();
+};
+
+/// Monotonic wall clock.
+class SystemClock : public Clock {
+public:
+    time_point now() const override;
+
+    void sleepUntil(time_point deadline) override;
+
+    bool isSimulated() const override {
+        return false;
+    }
+};
+
+/// Virtual time, starting at the clock epoch. Sleeping moves time forward instantly, so a run is only bound by CPU
+/// and every run of the same scenario sees exactly the same timestamps. Time never goes backwards.
+/// Deterministic as long as one thread drives it, e.g. the caller of StepEngine::runUntil().
+class SimulatedClock : public Clock {
+public:
+    SimulatedClock();
+
+    time_point now() const override;
+
+    void sleepUntil(time_point deadline) override;
+
+    bool isSimulated() const override {
+        return true;
+    }
+
+    /// Move time forward to deadline, earlier deadlines are ignored.
+    void advanceTo(time_point deadline);
+
+private:
+    std::atomic<duration::rep> m_Now;
+};
@@ -0,0 +1,243 @@
+#include "CommandLog.hpp"
+
+#include "LatencyMonitor.hpp"
+#include "Logger.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const uint8_t Magic[4] = {'R', 'S', 'C', 'L'};
+const uint8_t Version = 1;
+const size_t HeaderSize = 8;
+
+std::runtime_error systemError(const std::string &what, const std::string &path) {
+    return std::runtime_error(what + " '" + path + "': " + strerror(errno));
+}
+
+}
+
+CommandLog::Recorder::Recorder(const std::string &path)
+        : m_File(-1), m_Map(nullptr), m_Mapped(0), m_Length(0), m_LastTime(0), m_Records(0), m_Failed(false) {
+    m_File = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (m_File < 0) {
+        throw systemError("Cannot create command log", path);
+    }
+
+    if (!reserve(HeaderSize)) {
+        close(m_File);
+        throw std::runtime_error("Cannot reserve command log '" + path + "'");
+    }
+
+    memcpy(m_Map, Magic, sizeof(Magic));
+    m_Map[4] = Version;
+    m_Length = HeaderSize;
+}
+
+CommandLog::Recorder::~Recorder() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_Map) {
+        munmap(m_Map, m_Mapped);
+    }
+
+    // drop the zeroed tail of the last chunk, the reader stops at the padding if this fails
+    if (ftruncate(m_File, static_cast<off_t>(m_Length)) != 0) {
+        Logger::warning("Cannot trim command log, error '%s'.", strerror(errno));
+    }
+    close(m_File);
+}
+
+int64_t CommandLog::Recorder::stamp() {
+    int64_t received = LatencyMonitor::currentCommand();
+    return received != 0 ? received : LatencyMonitor::now();
+}
+
+bool CommandLog::Recorder::reserve(size_t size) {
+    if (m_Failed) {
+        return false;
+    }
+
+    if (m_Length + size <= m_Mapped) {
+        return true;
+    }
+
+    size_t mapped = m_Mapped;
+    while (mapped < m_Length + size) {
+        mapped += ChunkSize;
+    }
+
+    // allocate the blocks now, a store into a sparse page on a full card would raise SIGBUS instead of failing here
+    int error = posix_fallocate(m_File, static_cast<off_t>(m_Mapped), static_cast<off_t>(mapped - m_Mapped));
+
+    if (error != 0) {
+        Logger::error("Cannot grow command log, recording stops: '%s'.", strerror(error));
+        m_Failed = true;
+        return false;
+    }
+
+    void *map = m_Map ? mremap(m_Map, m_Mapped, mapped, MREMAP_MAYMOVE)
+                      : mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, m_File, 0);
+
+    if (map == MAP_FAILED) {
+        Logger::error("Cannot map command log, recording stops: '%s'.", strerror(errno));
+        m_Failed = true;
+        return false;
+    }
+
+    m_Map = static_cast<uint8_t *>(map);
+    m_Mapped = mapped;
+    return true;
+}
+
+void CommandLog::Recorder::writeVarint(uint64_t value) {
+    while (value >= 0x80) {
+        m_Map[m_Length++] = static_cast<uint8_t>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+
+    m_Map[m_Length++] = static_cast<uint8_t>(value);
+}
+
+void CommandLog::Recorder::beginRecord(Kind kind, int64_t time) {
+    // commands from different threads may carry slightly older receive stamps, never go backwards
+    int64_t delta = m_LastTime == 0 || time < m_LastTime ? 0 : time - m_LastTime;
+
+    if (time > m_LastTime) {
+        m_LastTime = time;
+    }
+
+    m_Map[m_Length++] = kind;
+    writeVarint(static_cast<uint64_t>(delta));
+}
+
+void CommandLog::Recorder::recordCommand(const std::string &message) {
+    int64_t time = stamp();
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!reserve(MaxRecordHeader + message.size())) {
+        return;
+    }
+    beginRecord(Command, time);
+    writeVarint(message.size());
+    memcpy(m_Map + m_Length, message.data(), message.size());
+    m_Length += message.size();
+
+    m_Records.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CommandLog::Recorder::recordVelocity(unsigned rig, int pitch, int yaw) {
+    int64_t time = stamp();
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!reserve(MaxRecordHeader + 3)) {
+        return;
+    }
+    beginRecord(Velocity, time);
+    m_Map[m_Length++] = static_cast<uint8_t>(rig);
+    m_Map[m_Length++] = static_cast<uint8_t>(static_cast<int8_t>(pitch));
+    m_Map[m_Length++] = static_cast<uint8_t>(static_cast<int8_t>(yaw));
+
+    m_Records.fetch_add(1, std::memory_order_relaxed);
+}
+
+CommandLog::Reader::Reader(const std::string &path) : m_Map(nullptr), m_Size(0), m_Offset(HeaderSize), m_Time(0) {
+    int file = open(path.c_str(), O_RDONLY);
+
+    if (file < 0) {
+        throw systemError("Cannot open command log", path);
+    }
+
+    struct stat info;
+
+    if (fstat(file, &info) != 0 || info.st_size < static_cast<off_t>(HeaderSize)) {
+        close(file);
+        throw std::runtime_error("Not a command log '" + path + "'");
+    }
+
+    void *map = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+
+    if (map == MAP_FAILED) {
+        throw systemError("Cannot map command log", path);
+    }
+
+    m_Map = static_cast<const uint8_t *>(map);
+    m_Size = static_cast<size_t>(info.st_size);
+
+    if (memcmp(m_Map, Magic, sizeof(Magic)) != 0 || m_Map[4] != Version) {
+        munmap(const_cast<uint8_t *>(m_Map), m_Size);
+        throw std::runtime_error("Not a command log '" + path + "'");
+    }
+}
+
+CommandLog::Reader::~Reader() {
+    munmap(const_cast<uint8_t *>(m_Map), m_Size);
+}
+
+bool CommandLog::Reader::readVarint(uint64_t &value) {
+    value = 0;
+
+    for (unsigned shift = 0; shift < 64 && m_Offset < m_Size; shift += 7) {
+        uint8_t byte = m_Map[m_Offset++];
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool CommandLog::Reader::next(Record &record) {
+    if (m_Offset >= m_Size || m_Map[m_Offset] == End) {
+        return false;
+    }
+
+    record.kind = static_cast<Kind>(m_Map[m_Offset++]);
+
+    uint64_t delta;
+
+    if (!readVarint(delta)) {
+        return false;
+    }
+
+    m_Time += static_cast<int64_t>(delta);
+    record.time = m_Time;
+
+    switch (record.kind) {
+        case Command: {
+            uint64_t length;
+
+            if (!readVarint(length) || length > m_Size - m_Offset) {
+                return false;
+            }
+
+            record.command.assign(reinterpret_cast<const char *>(m_Map + m_Offset), length);
+            m_Offset += length;
+            return true;
+        }
+        case Velocity:
+            if (m_Size - m_Offset < 3) {
+                return false;
+            }
+
+            record.rig = m_Map[m_Offset];
+            record.pitch = static_cast<int8_t>(m_Map[m_Offset + 1]);
+            record.yaw = static_cast<int8_t>(m_Map[m_Offset + 2]);
+            m_Offset += 3;
+            return true;
+        default:
+            // unknown kinds cannot be skipped, their length is unknown
+            return false;
+    }
+}
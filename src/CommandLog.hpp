@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+/// Binary log of inbound commands for reproducing sessions and load tests.
+///
+/// File layout:
+///   bytes 0..3  "RSCL"
+///   byte  4     version, 1
+///   bytes 5..7  reserved, 0
+///   records until the first zero kind byte or the end of the file:
+///     byte   kind, 1 text command or 2 joystick velocity
+///     varint nanoseconds since the previous record (LEB128, monotonic clock)
+///     kind 1: varint length, command bytes
+///     kind 2: u8 rig, int8 pitch, int8 yaw
+namespace CommandLog {
+
+enum Kind : uint8_t {
+    End = 0,
+    Command = 1,
+    Velocity = 2
+};
+
+/// Appends records through a shared memory mapping of the log file.
+/// The file grows in large chunks, so appending is a memcpy under an uncontended lock.
+class Recorder {
+public:
+    /// Create or truncate the log, throws std::runtime_error if it cannot be mapped.
+    explicit Recorder(const std::string &path);
+
+    /// Trims the file to the recorded length.
+    ~Recorder();
+
+    /// Record a text command, stamped with the receive time of the current command if there is one.
+    /// Once the disk is full recording stops with a logged error, the commands themselves still run.
+    void recordCommand(const std::string &message);
+
+    /// Record a joystick velocity datagram.
+    void recordVelocity(unsigned rig, int pitch, int yaw);
+
+    uint64_t getRecords() const {
+        return m_Records.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr size_t ChunkSize = 4 * 1024 * 1024;
+    /// Kind and two varints, larger commands are written in one go after growing.
+    static constexpr size_t MaxRecordHeader = 1 + 10 + 10;
+
+    /// Timestamp for a record made now.
+    static int64_t stamp();
+
+    /// Make room for size more bytes on disk, false if the file cannot grow. Called with m_mutex held.
+    bool reserve(size_t size);
+
+    void writeVarint(uint64_t value);
+
+    /// Kind byte and time delta. Called with m_mutex held.
+    void beginRecord(Kind kind, int64_t time);
+
+    std::mutex m_mutex;
+    int m_File;
+    uint8_t *m_Map;
+    size_t m_Mapped;
+    size_t m_Length;
+    int64_t m_LastTime;
+    std::atomic<uint64_t> m_Records;
+    /// Set when the file could not grow, nothing is recorded after that.
+    bool m_Failed;
+};
+
+/// One decoded record.
+struct Record {
+    Kind kind;
+    /// Nanoseconds since the first record.
+    int64_t time;
+    std::string command;
+    unsigned rig;
+    int pitch;
+    int yaw;
+};
+
+/// Reads a log written by Recorder through a read-only mapping.
+class Reader {
+public:
+    /// Throws std::runtime_error if the file is missing or not a command log.
+    explicit Reader(const std::string &path);
+
+    ~Reader();
+
+    /// Decode the next record.
+    /// @return False at the end of the log or at a truncated record.
+    bool next(Record &record);
+
+private:
+    bool readVarint(uint64_t &value);
+
+    const uint8_t *m_Map;
+    size_t m_Size;
+    size_t m_Offset;
+    int64_t m_Time;
+};
+
+}
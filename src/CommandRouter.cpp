@@ -0,0 +1,196 @@
+#include "CommandRouter.hpp"
+
+#include "LatencyMonitor.hpp"
+#include "Metrics.hpp"
+#include "MotorCommands.hpp"
+#include "RigRegistry.hpp"
+#include "Trace.hpp"
+
+#include <charconv>
+#include <memory>
+
+namespace {
+
+/// "lX" latency report X = 0 - keep, 1 - reset afterwards
+void latency(MotorController &, int value, const CommandReply &reply) {
+    if (reply) {
+        reply("L" + LatencyMonitor::instance().report());
+    }
+    if (value == 1) {
+        LatencyMonitor::instance().reset();
+    }
+}
+
+constexpr CommandBinding BuiltinBindings[] = {
+        {'l', &latency, false, nullptr}
+};
+
+/// Every opcode the rig understands, resolved while compiling.
+constexpr CommandTable Commands = CommandTable()
+        .with(BuiltinBindings)
+        .with(MotorCommands::Bindings);
+
+Metrics::Counter Rejected("rig_commands_rejected_total", "Malformed commands and commands for unknown rigs or opcodes");
+
+/// Run count per opcode, only registered opcodes get a series.
+Metrics::Counter *executed(char code) {
+    static const auto counters = []() {
+        std::array<std::unique_ptr<Metrics::Counter>, CommandTable::Size> table;
+
+        for (size_t i = 1; i < CommandTable::Size; i++) {
+            if (CommandRouter::isRegistered(static_cast<char>(i))) {
+                table[i].reset(new Metrics::Counter("rig_commands_total", "Commands run per opcode",
+                                                    "opcode=\"" + std::string(1, static_cast<char>(i)) + "\""));
+            }
+        }
+        return table;
+    }();
+
+    return counters[static_cast<unsigned char>(code) % CommandTable::Size].get();
+}
+
+}
+
+CommandRouter::CommandRouter(RigRegistry &rigs) : m_Rigs(rigs), m_Immediate(false), m_Scheduler(new CommandScheduler()) {
+}
+
+CommandRouter::~CommandRouter() = default;
+
+void CommandRouter::cancelScheduled() {
+    m_Scheduler->clear();
+}
+
+void CommandRouter::setOnScheduledRun(std::function<void()> hook) {
+    m_OnScheduledRun = std::move(hook);
+}
+
+void CommandRouter::setImmediate(bool immediate) {
+    m_Immediate = immediate;
+}
+
+bool CommandRouter::dispatch(const std::string &message, const CommandReply &reply) const {
+    Trace::Span span("dispatch", "command");
+
+    bool accepted = !message.empty() && message[0] == '@' ? schedule(message, reply) : route(message, reply);
+
+    if (!accepted) {
+        Rejected.add();
+        return false;
+    }
+    return true;
+}
+
+bool CommandRouter::schedule(const std::string &message, const CommandReply &reply) const {
+    const char *end = message.data() + message.size();
+    int64_t at = 0;
+    auto result = std::from_chars(message.data() + 1, end, at);
+
+    if (result.ec != std::errc() || result.ptr == end || *result.ptr != ':' || result.ptr + 1 == end) {
+        return false;
+    }
+
+    std::string command(result.ptr + 1, end);
+
+    if (m_Immediate) {
+        return route(command, reply);
+    }
+
+    // the command is checked when it runs, an unknown rig is answered then
+    if (!m_Scheduler->schedule(at, [this, command, reply]() {
+        if (m_OnScheduledRun) {
+            m_OnScheduledRun();
+        }
+        dispatch(command, reply);
+    })) {
+        if (reply) {
+            reply("Ecannot schedule");
+        }
+    }
+    return true;
+}
+
+bool CommandRouter::route(const std::string &message, const CommandReply &reply) const {
+    const char *begin = message.data();
+    const char *end = message.data() + message.size();
+    unsigned rig = 0;
+
+    if (begin != end && *begin >= '0' && *begin <= '9') {
+        auto result = std::from_chars(begin, end, rig);
+
+        if (result.ptr == end || *result.ptr != ':') {
+            return false;
+        }
+        begin = result.ptr + 1;
+    }
+
+    if (begin == end) {
+        return false;
+    }
+
+    const CommandBinding &binding = Commands[*begin];
+
+    if (!binding.handler && !binding.textHandler) {
+        return false;
+    }
+
+    MotorController *motors = m_Rigs.get(rig);
+
+    if (!motors) {
+        if (reply) {
+            reply("Eunknown rig");
+        }
+        return false;
+    }
+
+    auto &monitor = LatencyMonitor::instance();
+    executed(*begin)->add();
+
+    if (binding.textHandler) {
+        const std::string argument(begin + 1, end);
+        monitor.mark(LatencyMonitor::Parse);
+
+        if (binding.actuates) {
+            monitor.mark(LatencyMonitor::Dispatch);
+        }
+
+        binding.textHandler(*motors, argument, reply);
+        return true;
+    }
+
+    int value = parseNumber(begin + 1, end);
+    monitor.mark(LatencyMonitor::Parse);
+
+    if (binding.actuates) {
+        monitor.mark(LatencyMonitor::Dispatch);
+    }
+
+    binding.handler(*motors, value, reply);
+    return true;
+}
+
+int CommandRouter::parseValue(const std::string &message) {
+    if (message.empty()) {
+        return 0;
+    }
+
+    return parseNumber(message.data() + 1, message.data() + message.size());
+}
+
+int CommandRouter::parseNumber(const char *begin, const char *end) {
+    if (begin != end && *begin == '+') {
+        begin++;
+    }
+
+    int value = 0;
+
+    // no locale, no allocation, trailing characters are ignored like std::stoi did
+    if (std::from_chars(begin, end, value).ec != std::errc()) {
+        return 0;
+    }
+
+    return value;
+}
+
+bool CommandRouter::isRegistered(char code) {
+    return Commands[code].handler != nullptr || Commands[code].textHandler != nullptr;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "CommandScheduler.hpp"
+
+class MotorController;
+class RigRegistry;
+
+/// Answers a command on the connection it came from.
+typedef std::function<void(const std::string &)> CommandReply;
+
+/// Handles one opcode.
+/// @param value Decimal argument after the opcode, 0 if missing or malformed.
+typedef void (*CommandHandler)(MotorController &motors, int value, const CommandReply &reply);
+
+/// Handles an opcode whose argument is text, e.g. a preset name.
+/// @param argument Everything after the opcode.
+typedef void (*TextCommandHandler)(MotorController &motors, const std::string &argument, const CommandReply &reply);
+
+/// Opcode and handler, collected into a CommandTable at compile time.
+struct CommandBinding {
+    char code;
+    CommandHandler handler;
+    /// Counts towards the Dispatch latency stage, false for queries that never reach the motors.
+    bool actuates;
+    /// Called instead of handler if set.
+    TextCommandHandler textHandler;
+};
+
+/// Opcode to handler lookup indexed by the opcode character.
+///
+/// Modules declare their handlers next to the code they drive, export a constexpr CommandBinding array and get
+/// listed once in CommandRouter.cpp, so a new axis never touches main.
+class CommandTable {
+public:
+    static constexpr size_t Size = 128;
+
+    constexpr CommandTable() : m_Bindings() {
+    }
+
+    /// Table with the given bindings added, a later binding replaces an earlier one for the same opcode.
+    template <size_t N>
+    constexpr CommandTable with(const CommandBinding (&bindings)[N]) const {
+        CommandTable table = *this;
+
+        for (size_t i = 0; i < N; i++) {
+            table.m_Bindings[index(bindings[i].code)] = bindings[i];
+        }
+
+        return table;
+    }
+
+    /// Binding of the opcode, both handlers are nullptr if unknown.
+    constexpr const CommandBinding &operator[](char code) const {
+        return m_Bindings[index(code)];
+    }
+
+private:
+    /// Slot of an opcode, non ASCII opcodes share the never bound slot 0.
+    static constexpr size_t index(char code) {
+        return static_cast<unsigned char>(code) < Size ? static_cast<unsigned char>(code) : 0;
+    }
+
+    std::array<CommandBinding, Size> m_Bindings;
+};
+
+/// Decodes text commands ("p-50", "i1", ...) and calls the registered handler directly.
+///
+/// A command goes to rig 0 unless it starts with a rig id and a colon, e.g. "2:p-50" moves the pitch axis of rig 2.
+/// An unknown rig is answered with "Eunknown rig".
+///
+/// A command prefixed with "@T:" runs at T, CLOCK_REALTIME microseconds since the Unix epoch, e.g.
+/// "@1700000000250000:1:p80". Rigs with synchronized clocks then start together. A full schedule or a time more
+/// than CommandScheduler::MaxLead ahead is answered with "Ecannot schedule". A replay runs them at once instead, its
+/// log already holds every command at the time it ran.
+///
+/// The websocket, the shared memory ring and the scheduler all dispatch from threads of their own. Handlers run
+/// concurrently, every motor controller guards its own state, so a slow lens command never holds up a stop.
+class CommandRouter {
+public:
+    explicit CommandRouter(RigRegistry &rigs);
+    ~CommandRouter();
+
+    /// Parse and run one command, answers go to reply. Safe to call from any thread.
+    /// @return False if the message is empty, the rig or the opcode is unknown.
+    bool dispatch(const std::string &message, const CommandReply &reply) const;
+
+    /// Drop scheduled commands that did not run yet, before the connections they answer on go away.
+    void cancelScheduled();
+
+    /// Called on the scheduler thread right before a scheduled command runs, e.g. to feed the dead-man, which would
+    /// otherwise have given up on a quiet link long before a jog scheduled for later starts. Call before dispatching.
+    void setOnScheduledRun(std::function<void()> hook);
+
+    /// Strip the "@T:" prefix and run the command on the dispatching thread, so a replay on a simulated clock stays
+    /// deterministic. Call before dispatching.
+    void setImmediate(bool immediate);
+
+    /// Decimal argument of a command without rig prefix, 0 if missing or malformed.
+    static int parseValue(const std::string &message);
+
+    /// True if the opcode has a handler.
+    static bool isRegistered(char code);
+
+private:
+    /// dispatch() without the bookkeeping.
+    bool route(const std::string &message, const CommandReply &reply) const;
+
+    /// Decimal number in [begin, end), 0 if missing or malformed.
+    static int parseNumber(const char *begin, const char *end);
+
+    /// Queue a "@T:command" message, false if it is malformed.
+    bool schedule(const std::string &message, const CommandReply &reply) const;
+
+    RigRegistry &m_Rigs;
+    std::function<void()> m_OnScheduledRun;
+    bool m_Immediate;
+    /// Declared last so it stops before anything its actions use.
+    std::unique_ptr<CommandScheduler> m_Scheduler;
+};
@@ -0,0 +1,121 @@
+#include "CommandScheduler.hpp"
+
+#include "Metrics.hpp"
+#include "Trace.hpp"
+
+constexpr std::chrono::seconds CommandScheduler::MaxLead;
+
+namespace {
+
+/// Sleep until this long before a deadline and spin the rest, a thread wakes up tens of microseconds late.
+const std::chrono::microseconds SpinMargin(300);
+
+Metrics::Counter Scheduled("rig_scheduled_commands_total", "Commands queued for an absolute execution time");
+Metrics::Counter Late("rig_scheduled_commands_late_total", "Scheduled commands that arrived after their time");
+Metrics::Counter LatenessTime("rig_scheduled_commands_late_seconds_total",
+                              "Summed time scheduled commands arrived after their time", "", 1e-6);
+
+}
+
+CommandScheduler::CommandScheduler(size_t capacity) : m_Capacity(capacity), m_Order(0), m_Running(true) {
+    m_Thread = std::thread([this]() {
+        Trace::setThreadName("scheduler");
+        loop();
+    });
+}
+
+CommandScheduler::~CommandScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_Running = false;
+    }
+    m_changed.notify_one();
+    m_Thread.join();
+}
+
+int64_t CommandScheduler::realtimeNow() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+bool CommandScheduler::schedule(int64_t realtimeMicros, Action action) {
+    // nothing runs before the epoch, and the subtraction below cannot overflow for the rest
+    if (realtimeMicros < 0) {
+        return false;
+    }
+
+    // read both clocks back to back, the offset between them is what maps the deadline
+    auto steadyNow = std::chrono::steady_clock::now();
+    int64_t lead = realtimeMicros - realtimeNow();
+
+    if (lead > std::chrono::duration_cast<std::chrono::microseconds>(MaxLead).count()) {
+        return false;
+    }
+
+    if (lead < 0) {
+        Late.add();
+        LatenessTime.add(static_cast<uint64_t>(-lead));
+        lead = 0;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (m_Pending.size() >= m_Capacity) {
+            return false;
+        }
+
+        m_Pending.push(Entry{steadyNow + std::chrono::microseconds(lead), m_Order++, std::move(action)});
+    }
+
+    Scheduled.add();
+    m_changed.notify_one();
+    return true;
+}
+
+void CommandScheduler::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_Pending = std::priority_queue<Entry>();
+}
+
+size_t CommandScheduler::getPending() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_Pending.size();
+}
+
+void CommandScheduler::loop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (m_Running) {
+        if (m_Pending.empty()) {
+            m_changed.wait(lock);
+            continue;
+        }
+
+        auto deadline = m_Pending.top().deadline;
+        auto now = std::chrono::steady_clock::now();
+
+        if (deadline - now > SpinMargin) {
+            // an earlier command may arrive meanwhile, look again after every wake
+            m_changed.wait_until(lock, deadline - SpinMargin);
+            continue;
+        }
+
+        if (now < deadline) {
+            // spin without the lock, a command scheduled meanwhile is picked up by the next pass
+            lock.unlock();
+            while (std::chrono::steady_clock::now() < deadline) {
+            }
+            lock.lock();
+            continue;
+        }
+
+        // top() is const, the action is moved out right before popping it
+        Action action = std::move(const_cast<Entry &>(m_Pending.top()).action);
+        m_Pending.pop();
+
+        lock.unlock();
+        action();
+        lock.lock();
+    }
+}
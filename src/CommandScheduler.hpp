@@ -0,0 +1,69 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/// Runs actions at an absolute wall clock time, so rigs that share a PTP or NTP synchronized clock start a move
+/// together no matter how long each command took through the network.
+///
+/// Deadlines are given in CLOCK_REALTIME and mapped onto the steady clock when they are scheduled, a clock step
+/// while an action is pending does not move it. The thread sleeps until shortly before the earliest deadline and
+/// spins the rest of the way, so an action starts within a few microseconds of its time. Actions whose time has
+/// passed run at once, e.g. when a recorded session is replayed.
+class CommandScheduler {
+public:
+    typedef std::function<void()> Action;
+
+    /// Refuse deadlines further ahead than this, a typo should not park a command for days.
+    static constexpr std::chrono::seconds MaxLead{600};
+
+    /// @param capacity Pending actions before schedule() refuses more.
+    explicit CommandScheduler(size_t capacity = 256);
+
+    /// Drops pending actions.
+    ~CommandScheduler();
+
+    CommandScheduler(const CommandScheduler &) = delete;
+    CommandScheduler &operator=(const CommandScheduler &) = delete;
+
+    /// Run action on the scheduler thread at realtimeMicros, microseconds since the Unix epoch.
+    /// Actions with the same deadline run in the order they were scheduled.
+    /// @return False if the queue is full, or the deadline is before the epoch or more than MaxLead ahead.
+    bool schedule(int64_t realtimeMicros, Action action);
+
+    /// Drop all pending actions, e.g. before the connections they answer on go away.
+    void clear();
+
+    size_t getPending() const;
+
+    /// CLOCK_REALTIME in microseconds since the Unix epoch.
+    static int64_t realtimeNow();
+
+private:
+    struct Entry {
+        std::chrono::steady_clock::time_point deadline;
+        uint64_t order;
+        Action action;
+
+        /// Earliest first in a std::priority_queue.
+        bool operator<(const Entry &other) const {
+            return deadline != other.deadline ? deadline > other.deadline : order > other.order;
+        }
+    };
+
+    void loop();
+
+    size_t m_Capacity;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::priority_queue<Entry> m_Pending;
+    uint64_t m_Order;
+    bool m_Running;
+    std::thread m_Thread;
+};
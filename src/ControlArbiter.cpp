@@ -0,0 +1,135 @@
+#include "ControlArbiter.hpp"
+
+ControlArbiter::ControlArbiter() : m_NextId(1), m_Holder(0) {
+}
+
+unsigned ControlArbiter::add(websocketpp::connection_hdl hdl) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    unsigned id = m_NextId++;
+    m_Operators[hdl] = id;
+    return id;
+}
+
+void ControlArbiter::remove(websocketpp::connection_hdl hdl) {
+    bool changed = false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_Operators.find(hdl);
+
+        if (it == m_Operators.end()) {
+            return;
+        }
+
+        if (it->second == m_Holder) {
+            changed = setHolder(0);
+        }
+
+        m_Operators.erase(it);
+    }
+
+    if (changed) {
+        onHolderChanged(0);
+    }
+}
+
+unsigned ControlArbiter::getId(websocketpp::connection_hdl hdl) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_Operators.find(hdl);
+    return it == m_Operators.end() ? 0 : it->second;
+}
+
+unsigned ControlArbiter::getHolder() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_Holder;
+}
+
+bool ControlArbiter::isHolder(websocketpp::connection_hdl hdl) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_Operators.find(hdl);
+    return it != m_Operators.end() && it->second == m_Holder;
+}
+
+bool ControlArbiter::claim(websocketpp::connection_hdl hdl, bool takeOver) {
+    unsigned id = 0;
+    bool changed = false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_Operators.find(hdl);
+
+        if (it == m_Operators.end()) {
+            return false;
+        }
+
+        id = it->second;
+
+        if (m_Holder != 0 && m_Holder != id && !takeOver) {
+            return false;
+        }
+
+        changed = setHolder(id);
+    }
+
+    if (changed) {
+        onHolderChanged(id);
+    }
+
+    return true;
+}
+
+void ControlArbiter::release(websocketpp::connection_hdl hdl) {
+    bool changed = false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_Operators.find(hdl);
+
+        if (it != m_Operators.end() && it->second == m_Holder) {
+            changed = setHolder(0);
+        }
+    }
+
+    if (changed) {
+        onHolderChanged(0);
+    }
+}
+
+bool ControlArbiter::handOff(websocketpp::connection_hdl hdl, unsigned target) {
+    bool changed = false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_Operators.find(hdl);
+
+        if (it == m_Operators.end() || it->second != m_Holder) {
+            return false;
+        }
+
+        bool known = false;
+        for (auto &op : m_Operators) {
+            known = known || op.second == target;
+        }
+
+        if (!known) {
+            return false;
+        }
+
+        changed = setHolder(target);
+    }
+
+    if (changed) {
+        onHolderChanged(target);
+    }
+
+    return true;
+}
+
+bool ControlArbiter::setHolder(unsigned id) {
+    if (m_Holder == id) {
+        return false;
+    }
+
+    m_Holder = id;
+    return true;
+}
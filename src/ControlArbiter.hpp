@@ -0,0 +1,62 @@
+#pragma once
+
+#include <boost/signals2/signal.hpp>
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+// ignore datatype conversion warnings
+#pragma warning(push)
+#pragma warning(disable : 4267)
+#include <websocketpp/common/connection_hdl.hpp>
+#pragma warning(pop)
+
+/// Hands out a single control token among the operators connected to the rig.
+/// Operators are numbered from 1 in connection order, 0 means nobody holds the token.
+class ControlArbiter {
+public:
+    ControlArbiter();
+
+    /// Register a new operator.
+    /// @return Id of the operator.
+    unsigned add(websocketpp::connection_hdl hdl);
+
+    /// Forget an operator. A held token becomes free.
+    void remove(websocketpp::connection_hdl hdl);
+
+    /// Id of a registered operator or 0.
+    unsigned getId(websocketpp::connection_hdl hdl) const;
+
+    /// Id of the current token holder or 0.
+    unsigned getHolder() const;
+
+    /// True if hdl holds the token.
+    bool isHolder(websocketpp::connection_hdl hdl) const;
+
+    /// Take the token if it is free or, with takeOver set, away from the current holder.
+    /// @return True if hdl holds the token afterwards.
+    bool claim(websocketpp::connection_hdl hdl, bool takeOver);
+
+    /// Give up the token. Ignored unless hdl holds it.
+    void release(websocketpp::connection_hdl hdl);
+
+    /// Pass the token to another operator. Only the holder may hand off.
+    /// @return False if hdl does not hold the token or target is unknown.
+    bool handOff(websocketpp::connection_hdl hdl, unsigned target);
+
+    /// The token changed hands, the new holder id (0 = free) is passed.
+    /// Fired outside the internal lock.
+    boost::signals2::signal<void(unsigned)> onHolderChanged;
+
+private:
+    typedef std::map<websocketpp::connection_hdl, unsigned, std::owner_less<websocketpp::connection_hdl>> OperatorList;
+
+    /// Set the holder under lock and report whether it changed.
+    bool setHolder(unsigned id);
+
+    mutable std::mutex m_mutex;
+    OperatorList m_Operators;
+    unsigned m_NextId;
+    unsigned m_Holder;
+};
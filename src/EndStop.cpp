@@ -0,0 +1,124 @@
+#include <stdexcept>
+#include <string>
+#include "EndStop.hpp"
+#include "Gpio.hpp"
+
+namespace
+{
+const int PinCount = 64;
+
+// end-stop of every pin, guarded by registryMutex so a switch is never destroyed while its edge is handled
+std::mutex registryMutex;
+std::array<EndStop*, PinCount> registry = {};
+// wiringPi starts a thread per registered pin, register each pin only once
+std::array<bool, PinCount> installed = {};
+}
+
+template <int Pin>
+void EndStop::interrupt()
+{
+    dispatch(Pin);
+}
+
+template <int... Pins>
+std::array<void (*)(), sizeof...(Pins)> EndStop::interrupts(std::integer_sequence<int, Pins...>)
+{
+    return {{&EndStop::interrupt<Pins>...}};
+}
+
+EndStop::EndStop(int pin)
+    : m_Pin(pin), m_Closed(false), m_Cancelled(false)
+{
+    if(pin < 0 || pin >= PinCount)
+    {
+        throw std::invalid_argument("end-stop pin " + std::to_string(pin) + " out of range");
+    }
+
+    pinMode(pin, INPUT);
+    pullUpDnControl(pin, PUD_UP);
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    if(registry[pin])
+    {
+        throw std::invalid_argument("end-stop pin " + std::to_string(pin) + " is used twice");
+    }
+
+    if(!installed[pin])
+    {
+        static const auto handlers = interrupts(std::make_integer_sequence<int, PinCount>());
+        if(wiringPiISR(pin, INT_EDGE_FALLING, handlers[pin]) < 0)
+        {
+            throw std::runtime_error("cannot set up the interrupt of end-stop pin " + std::to_string(pin));
+        }
+        installed[pin] = true;
+    }
+    registry[pin] = this;
+}
+
+EndStop::~EndStop()
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    registry[m_Pin] = nullptr;
+}
+
+bool EndStop::isClosed() const
+{
+    return digitalRead(m_Pin) == LOW;
+}
+
+void EndStop::setOnClosed(std::function<void()> handler)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_OnClosed = std::move(handler);
+}
+
+void EndStop::arm()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_Closed = false;
+}
+
+bool EndStop::waitClosed(std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_closed.wait_for(lock, timeout, [this]()
+    {
+        return m_Closed || m_Cancelled;
+    });
+    return m_Closed && !m_Cancelled;
+}
+
+void EndStop::cancel()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_Cancelled = true;
+    }
+    m_closed.notify_all();
+}
+
+void EndStop::dispatch(int pin)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    if(registry[pin])
+    {
+        registry[pin]->onEdge();
+    }
+}
+
+void EndStop::onEdge()
+{
+    std::function<void()> handler;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_Closed = true;
+        handler = m_OnClosed;
+    }
+
+    // stop the axis first, the waiter reads its position
+    if(handler)
+    {
+        handler();
+    }
+    m_closed.notify_all();
+}
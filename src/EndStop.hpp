@@ -0,0 +1,54 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <utility>
+
+// Normally open limit switch between a GPIO pin and ground, read through the internal pull-up.
+// Closing edges arrive through wiringPiISR, so nobody polls the pin; the fake GPIO of the desktop
+// simulation delivers them from virtual pins the same way.
+class EndStop
+{
+public:
+    // wiringPi can not unregister a handler, the pin stays claimed for the life of the process
+    explicit EndStop(int pin);
+    ~EndStop();
+
+    int getPin() const
+    {
+        return m_Pin;
+    }
+
+    // Current switch state
+    bool isClosed() const;
+
+    // Called on the interrupt thread on every closing edge, before waiters wake up
+    void setOnClosed(std::function<void()> handler);
+
+    // Forget earlier edges, the next waitClosed() waits for a new one
+    void arm();
+
+    // Block until the switch closed after arm(), false on timeout or once cancelled
+    bool waitClosed(std::chrono::milliseconds timeout);
+
+    // Release all current and future waiters, used when the axis shuts down during homing
+    void cancel();
+private:
+    // wiringPi handlers take no argument, so every pin gets a handler of its own
+    template <int Pin>
+    static void interrupt();
+    template <int... Pins>
+    static std::array<void (*)(), sizeof...(Pins)> interrupts(std::integer_sequence<int, Pins...>);
+    static void dispatch(int pin);
+    void onEdge();
+
+    int m_Pin;
+    std::function<void()> m_OnClosed;
+
+    std::mutex m_mutex;
+    std::condition_variable m_closed;
+    bool m_Closed;
+    bool m_Cancelled;
+};
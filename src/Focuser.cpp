@@ -4,20 +4,16 @@
 #include <algorithm>
 
 #include "Focuser.hpp"
-#include <iostream>
 
-#if RASPI == 1
-#include <wiringPi.h>
-#include <wiringPiI2C.h>
-#else
-int wiringPiI2CSetup(int){return -1;}
-int wiringPiI2CWriteReg16(int,int,int){return -1;}
-int wiringPiI2CReadReg16(int,int){return -1;}
-#endif
+#include "Gpio.hpp"
+#include "LatencyMonitor.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "StopWatch.hpp"
+#include "Trace.hpp"
 
 using namespace std;
 
-int CHIP_I2C_ADDR = 0x0C;
 int BUSY_REG_ADDR = 0x04;
 
 int OPT_BASE    = 0x1000;
@@ -28,32 +24,45 @@ int OPT_MOTOR_Y = OPT_BASE | 0x04;
 int OPT_IRCUT   = OPT_BASE | 0x05;
 int NONE = -1;
 
+static Metrics::Counter I2cTransactions("rig_i2c_transactions_total", "Register reads and writes on the lens drivers");
+static Metrics::Counter I2cTime("rig_i2c_seconds_total", "Time spent in lens driver register reads and writes", "",
+                                1e-9);
+static Metrics::Counter BusyWaitTime("rig_lens_busy_wait_seconds_total", "Time spent waiting for busy lens drivers",
+                                     "", 1e-9);
+
+// account one register transaction that started at the given timestamp
+static void countTransaction(int64_t start)
+{
+    I2cTransactions.add();
+    I2cTime.add(static_cast<uint64_t>(StopWatch::timestamp() - start));
+}
+
 Focuser::~Focuser()
 {
 }
 
-// Default constructor
-Focuser::Focuser()
+Focuser::Focuser(int address, std::shared_ptr<Clock> clock)
+    : m_Clock(std::move(clock))
 {
+    // initial position is always zero
+    m_Focus = m_Zoom = 0;
+    m_IrCut = false;
+    m_Busy = false;
+
     // Setup i2c handle for communication with the driver
-    m_chipAddr = wiringPiI2CSetup (CHIP_I2C_ADDR);
+    m_chipAddr = wiringPiI2CSetup (address);
     if(m_chipAddr < 0)
     {
-        std::cerr << "Error initializing i2c device (Zoom and Focus)\n";
+        Logger::error("Error initializing i2c device 0x%02x (Zoom and Focus)", address);
         return;
     }
 
-
-    // initial position is always zero
-    m_Focus = m_Zoom = 0;
-    m_IrCut = false;
-
     std::map<std::string, int> focus, zoom, motorx, motory, ircut;
     focus["REG_ADDR"] = 0x01;
     focus["MAX_VALUE"] = 18000;
     focus["RESET_ADDR"] = 0x01 + 0x0A;
     zoom["REG_ADDR"] = 0x00;
-    zoom["MAX_VALUE"] = 18000;
+    zoom["MAX_VALUE"] = MaxZoom;
     zoom["RESET_ADDR"] = 0x00 + 0x0A;
     motorx["REG_ADDR"] = 0x05;
     motorx["MAX_VALUE"] = 180;
@@ -81,7 +90,7 @@ void Focuser::setFocus(int value, bool blocking) {
 void Focuser::setZoom(int value, bool blocking) {
     waitForFree();
     m_Zoom += value;
-    set(OPT_ZOOM, m_Focus, blocking);
+    set(OPT_ZOOM, m_Zoom, blocking);
 }
 void Focuser::setIRCut(bool value, bool blocking)
 {
@@ -90,34 +99,92 @@ void Focuser::setIRCut(bool value, bool blocking)
     set(OPT_IRCUT, (int)m_IrCut, blocking);
 }
 
+void Focuser::moveTo(int focus, int zoom, bool irCut)
+{
+    m_Zoom = zoom;
+    set(OPT_ZOOM, zoom, true);
+    m_Focus = focus;
+    set(OPT_FOCUS, focus, true);
+    if(m_IrCut != irCut)
+    {
+        m_IrCut = irCut;
+        set(OPT_IRCUT, (int)irCut, true);
+    }
+}
+
+void Focuser::restore(int focus, int zoom, bool irCut)
+{
+    m_Focus = focus;
+    m_Zoom = zoom;
+    m_IrCut = irCut;
+}
+
+int Focuser::getFocus() const
+{
+    return m_Focus;
+}
+
+int Focuser::getZoom() const
+{
+    return m_Zoom;
+}
+
+bool Focuser::getIRCut() const
+{
+    return m_IrCut;
+}
+
+bool Focuser::wasBusy() const
+{
+    return m_Busy;
+}
+
 int Focuser::read(int reg_Addr)
 {
+    Trace::Span span("i2c read", "lens");
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int64_t start = StopWatch::timestamp();
     int value = wiringPiI2CReadReg16 (m_chipAddr, reg_Addr);
+    countTransaction(start);
     value = ((value & 0x00FF)<< 8) | ((value & 0xFF00) >> 8);
     return value;
 }
 
 int Focuser::write(int reg_Addr, int value)
 {
+    Trace::Span span("i2c write", "lens");
     if(value < 0)
         value = 0;
     value = ((value & 0x00FF)<< 8) | ((value & 0xFF00) >> 8);
-    return wiringPiI2CWriteReg16 (m_chipAddr, reg_Addr, value);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int64_t start = StopWatch::timestamp();
+    int result = wiringPiI2CWriteReg16 (m_chipAddr, reg_Addr, value);
+    countTransaction(start);
+    return result;
 }
 
 bool Focuser::isBusy()
 {
-    return read(BUSY_REG_ADDR) != 0;
+    // without a driver there is nothing to wait for
+    if(m_chipAddr < 0)
+        return false;
+    m_Busy = read(BUSY_REG_ADDR) != 0;
+    return m_Busy;
 }
 
 // wait until device is free again
 void Focuser::waitForFree()
 {
     int count = 0;
+    auto start = m_Clock->now();
     while(isBusy() && count < (5 / 0.01))
     {
         count++;
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        m_Clock->sleepFor(std::chrono::milliseconds(100));
+    }
+    if(count > 0)
+    {
+        BusyWaitTime.add(std::chrono::duration_cast<std::chrono::nanoseconds>(m_Clock->now() - start).count());
     }
 }
 
@@ -153,6 +220,7 @@ void Focuser::set(int opt, int value, bool blocking)
         value = 0;
 
     write(info["REG_ADDR"],value); // check return?
+    LatencyMonitor::instance().mark(LatencyMonitor::Actuate);
 
     if(blocking)
         waitForFree();
@@ -12,6 +12,9 @@
 #include <atomic>
 #include <map>
 #include <string>
+#include <memory>
+#include <mutex>
+#include "Clock.hpp"
 
 
 using namespace std;
@@ -19,12 +22,31 @@ using namespace std;
 class Focuser
 {
 public:
-    Focuser();
+    // zoom value at the long end, 0 is the widest angle
+    static const int MaxZoom = 18000;
+
+    // Lens driver at the given I2C address, 0x0C unless it was strapped differently.
+    // Busy polling waits on the given clock.
+    explicit Focuser(int address = 0x0C, std::shared_ptr<Clock> clock = Clock::system());
     ~Focuser();
 
     void setFocus(int value, bool blocking);
     void setZoom(int value, bool blocking);
     void setIRCut(bool value, bool blocking);
+
+    // Drive to absolute lens values, zoom first since it shifts the focal plane the focus value belongs to.
+    // Blocks until the driver is idle again.
+    void moveTo(int focus, int zoom, bool irCut);
+
+    // Take over lens values a previous process left in the driver, without touching the bus
+    void restore(int focus, int zoom, bool irCut);
+
+    // Last commanded lens values, safe to read from any thread
+    int getFocus() const;
+    int getZoom() const;
+    bool getIRCut() const;
+    // Busy state seen by the last register poll, does not touch the bus
+    bool wasBusy() const;
 private:
     int read(int reg_Addr);
     int write(int reg_Addr, int value);
@@ -38,10 +60,14 @@ private:
     int get(int opt);
     void set(int opt, int value, bool blocking = false);
 
+    std::shared_ptr<Clock> m_Clock;
+    // one bus transaction at a time. Busy polls hold no lock, a command waiting for the driver keeps no other off it.
+    std::mutex m_mutex;
     int m_chipAddr;
-    int m_Focus;
-    int m_Zoom;
-    bool m_IrCut;
+    std::atomic<int> m_Focus;
+    std::atomic<int> m_Zoom;
+    std::atomic<bool> m_IrCut;
+    std::atomic<bool> m_Busy;
     std::map<int, std::map<std::string, int>> m_opts;
 };
 
@@ -0,0 +1,150 @@
+#pragma once
+
+// wiringPi on the raspberry pi, no-op fakes everywhere else so the motor code
+// builds and runs as a simulation on a desktop
+
+#if RASPI == 1
+#include <wiringPi.h>
+#include <wiringPiI2C.h>
+#else
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+
+#define PUD_OFF 0
+#define PUD_DOWN 1
+#define PUD_UP 2
+
+#define INT_EDGE_SETUP 0
+#define INT_EDGE_FALLING 1
+#define INT_EDGE_RISING 2
+#define INT_EDGE_BOTH 3
+
+// Levels of the input pins the simulation drives through virtualPinWrite(), and the interrupt
+// handlers registered for them. Like wiringPi every handler runs on a thread of its own.
+struct VirtualPins
+{
+    static const int Count = 64;
+
+    struct Pin
+    {
+        int level = LOW;
+        int edges = INT_EDGE_SETUP;
+        void (*handler)() = nullptr;
+        unsigned pending = 0;
+    };
+
+    // never destroyed, handler threads may still wait on it while the process exits
+    static VirtualPins& instance()
+    {
+        static VirtualPins* pins = new VirtualPins();
+        return *pins;
+    }
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::array<Pin, Count> pins;
+};
+
+inline int wiringPiSetup() { return 0; }
+inline void pinMode(int, int) {}
+// outputs keep their level too, so a simulation can read back what the coils hold
+inline void digitalWrite(int pin, int level)
+{
+    if(pin < 0 || pin >= VirtualPins::Count)
+        return;
+
+    VirtualPins& virtualPins = VirtualPins::instance();
+    std::lock_guard<std::mutex> lock(virtualPins.mutex);
+    virtualPins.pins[pin].level = level;
+}
+
+inline int digitalRead(int pin)
+{
+    VirtualPins& virtualPins = VirtualPins::instance();
+    std::lock_guard<std::mutex> lock(virtualPins.mutex);
+    return pin >= 0 && pin < VirtualPins::Count ? virtualPins.pins[pin].level : LOW;
+}
+
+inline void pullUpDnControl(int pin, int pud)
+{
+    VirtualPins& virtualPins = VirtualPins::instance();
+    std::lock_guard<std::mutex> lock(virtualPins.mutex);
+    if(pin >= 0 && pin < VirtualPins::Count && pud != PUD_OFF)
+        virtualPins.pins[pin].level = pud == PUD_UP ? HIGH : LOW;
+}
+
+inline int wiringPiISR(int pin, int edges, void (*handler)())
+{
+    if(pin < 0 || pin >= VirtualPins::Count)
+        return -1;
+
+    VirtualPins& virtualPins = VirtualPins::instance();
+    {
+        std::lock_guard<std::mutex> lock(virtualPins.mutex);
+        virtualPins.pins[pin].edges = edges;
+        virtualPins.pins[pin].handler = handler;
+    }
+
+    // the handler thread lives as long as the process, as it does with wiringPi
+    std::thread([pin, &virtualPins]()
+    {
+        std::unique_lock<std::mutex> lock(virtualPins.mutex);
+        while(true)
+        {
+            virtualPins.changed.wait(lock, [&]() { return virtualPins.pins[pin].pending > 0; });
+            virtualPins.pins[pin].pending--;
+            void (*handler)() = virtualPins.pins[pin].handler;
+
+            lock.unlock();
+            handler();
+            lock.lock();
+        }
+    }).detach();
+    return 0;
+}
+
+// Drive a simulated input, fires the interrupt handler of the pin on a matching edge
+inline void virtualPinWrite(int pin, int level)
+{
+    if(pin < 0 || pin >= VirtualPins::Count)
+        return;
+
+    VirtualPins& virtualPins = VirtualPins::instance();
+    {
+        std::lock_guard<std::mutex> lock(virtualPins.mutex);
+        VirtualPins::Pin& state = virtualPins.pins[pin];
+        if(state.level == level)
+            return;
+
+        state.level = level;
+        int edge = level == HIGH ? INT_EDGE_RISING : INT_EDGE_FALLING;
+        if(!state.handler || !(state.edges & edge))
+            return;
+        state.pending++;
+    }
+    virtualPins.changed.notify_all();
+}
+
+inline void delayMicroseconds(unsigned int howLong)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(howLong));
+}
+
+inline void delay(unsigned int howLong)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(howLong));
+}
+
+// the fake lens driver accepts every write and is never busy
+inline int wiringPiI2CSetup(int) { return 0; }
+inline int wiringPiI2CWriteReg16(int, int, int) { return 0; }
+inline int wiringPiI2CReadReg16(int, int) { return 0; }
+#endif
@@ -0,0 +1,83 @@
+#include "LatencyHistogram.hpp"
+
+#include <cmath>
+
+LatencyHistogram::LatencyHistogram() : m_Count(0), m_Sum(0), m_Max(0) {
+    for (auto &bucket : m_Buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+size_t LatencyHistogram::bucketIndex(uint64_t value) {
+    if (value < SubBucketCount) {
+        return static_cast<size_t>(value);
+    }
+
+    unsigned msb = 63 - __builtin_clzll(value);
+    unsigned shift = msb - SubBucketBits + 1;
+    uint64_t sub = value >> shift;
+
+    return static_cast<size_t>(SubBucketCount + (shift - 1) * SubBucketHalf + (sub - SubBucketHalf));
+}
+
+uint64_t LatencyHistogram::bucketValue(size_t index) {
+    if (index < SubBucketCount) {
+        return index;
+    }
+
+    uint64_t offset = index - SubBucketCount;
+    unsigned shift = static_cast<unsigned>(offset / SubBucketHalf) + 1;
+    uint64_t sub = offset % SubBucketHalf + SubBucketHalf;
+
+    return (sub << shift) + ((1ull << shift) - 1);
+}
+
+void LatencyHistogram::record(uint64_t value) {
+    m_Buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    m_Count.fetch_add(1, std::memory_order_relaxed);
+    m_Sum.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t max = m_Max.load(std::memory_order_relaxed);
+    while (value > max && !m_Max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t LatencyHistogram::percentile(double percent) const {
+    uint64_t count = getCount();
+
+    if (count == 0) {
+        return 0;
+    }
+
+    auto target = static_cast<uint64_t>(std::ceil(percent / 100.0 * count));
+    target = target == 0 ? 1 : target;
+
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < BucketCount; i++) {
+        seen += m_Buckets[i].load(std::memory_order_relaxed);
+
+        if (seen >= target) {
+            // never report more than was actually recorded
+            uint64_t value = bucketValue(i);
+            return value < getMax() ? value : getMax();
+        }
+    }
+
+    return getMax();
+}
+
+double LatencyHistogram::getMean() const {
+    uint64_t count = getCount();
+    return count == 0 ? 0.0 : static_cast<double>(m_Sum.load(std::memory_order_relaxed)) / count;
+}
+
+void LatencyHistogram::reset() {
+    for (auto &bucket : m_Buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+
+    m_Count = 0;
+    m_Sum = 0;
+    m_Max = 0;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/// Lock-free log-linear histogram in the style of HdrHistogram.
+/// Values below 64 are exact, above that every power of two is split into 32 buckets,
+/// which bounds the relative error to about 3% over the full 64 bit range.
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    /// Add one value, safe from any thread.
+    void record(uint64_t value);
+
+    /// Value at the given percentile [0,100], 0 if empty.
+    uint64_t percentile(double percent) const;
+
+    uint64_t getCount() const {
+        return m_Count.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getMax() const {
+        return m_Max.load(std::memory_order_relaxed);
+    }
+
+    /// Mean value, 0 if empty.
+    double getMean() const;
+
+    /// Clear all buckets. Values recorded concurrently may be lost.
+    void reset();
+
+private:
+    static constexpr unsigned SubBucketBits = 6;
+    static constexpr uint64_t SubBucketCount = 1ull << SubBucketBits;
+    static constexpr uint64_t SubBucketHalf = SubBucketCount / 2;
+    static constexpr size_t BucketCount = SubBucketCount + (64 - SubBucketBits) * SubBucketHalf;
+
+    static size_t bucketIndex(uint64_t value);
+
+    /// Highest value that falls into the bucket.
+    static uint64_t bucketValue(size_t index);
+
+    std::array<std::atomic<uint64_t>, BucketCount> m_Buckets;
+    std::atomic<uint64_t> m_Count;
+    std::atomic<uint64_t> m_Sum;
+    std::atomic<uint64_t> m_Max;
+};
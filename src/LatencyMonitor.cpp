@@ -0,0 +1,86 @@
+#include "LatencyMonitor.hpp"
+
+#include "StopWatch.hpp"
+
+#include <cstdio>
+
+namespace {
+
+/// Receive stamp of the command the current thread is working on.
+thread_local int64_t t_Received = 0;
+
+}
+
+LatencyMonitor::CommandScope::CommandScope() {
+    t_Received = LatencyMonitor::now();
+}
+
+LatencyMonitor::CommandScope::~CommandScope() {
+    t_Received = 0;
+}
+
+LatencyMonitor &LatencyMonitor::instance() {
+    static LatencyMonitor monitor;
+    return monitor;
+}
+
+int64_t LatencyMonitor::now() {
+    return StopWatch::timestamp();
+}
+
+int64_t LatencyMonitor::currentCommand() {
+    return t_Received;
+}
+
+void LatencyMonitor::mark(Stage stage) {
+    record(stage, t_Received);
+}
+
+void LatencyMonitor::record(Stage stage, int64_t received) {
+    if (received == 0) {
+        return;
+    }
+
+    int64_t elapsed = now() - received;
+    m_Histograms[stage].record(elapsed > 0 ? static_cast<uint64_t>(elapsed) : 0);
+}
+
+std::string LatencyMonitor::report() const {
+    std::string out;
+
+    for (int i = 0; i < StageCount; i++) {
+        auto &histogram = m_Histograms[i];
+        char line[160];
+
+        snprintf(line, sizeof(line), "%-8s n=%llu p50=%.1fus p99=%.1fus p999=%.1fus max=%.1fus\n",
+                 stageName(static_cast<Stage>(i)),
+                 static_cast<unsigned long long>(histogram.getCount()),
+                 histogram.percentile(50) / 1000.0,
+                 histogram.percentile(99) / 1000.0,
+                 histogram.percentile(99.9) / 1000.0,
+                 histogram.getMax() / 1000.0);
+
+        out += line;
+    }
+
+    return out;
+}
+
+void LatencyMonitor::reset() {
+    for (auto &histogram : m_Histograms) {
+        histogram.reset();
+    }
+}
+
+const char *LatencyMonitor::stageName(Stage stage) {
+    switch (stage) {
+        case Parse:
+            return "parse";
+        case Dispatch:
+            return "dispatch";
+        case Actuate:
+            return "actuate";
+        default:
+            return "?";
+    }
+}
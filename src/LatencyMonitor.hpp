@@ -0,0 +1,54 @@
+#pragma once
+
+#include "LatencyHistogram.hpp"
+
+#include <cstdint>
+#include <string>
+
+/// Process wide command latency statistics.
+///
+/// The network layer opens a CommandScope when a message arrives. Later stages on the same thread
+/// call mark(), stages on other threads take currentCommand() along and call record() when they act.
+/// Every stage is measured from the receive stamp, so the histograms read as "time until ...".
+class LatencyMonitor {
+public:
+    enum Stage {
+        Parse,      ///< Message decoded into opcode and value
+        Dispatch,   ///< Call into MotorController
+        Actuate,    ///< First GPIO edge or I2C write caused by the command
+        StageCount
+    };
+
+    /// Marks the current thread as handling a command received now.
+    class CommandScope {
+    public:
+        CommandScope();
+        ~CommandScope();
+    };
+
+    static LatencyMonitor &instance();
+
+    /// Monotonic timestamp in nanoseconds.
+    static int64_t now();
+
+    /// Receive stamp of the command handled by this thread, 0 if none.
+    static int64_t currentCommand();
+
+    /// Record a stage for the command handled by this thread.
+    void mark(Stage stage);
+
+    /// Record a stage for a command received at the given stamp. A zero stamp is ignored.
+    void record(Stage stage, int64_t received);
+
+    /// One line per stage with count, percentiles and max in microseconds.
+    std::string report() const;
+
+    void reset();
+
+    static const char *stageName(Stage stage);
+
+private:
+    LatencyMonitor() = default;
+
+    LatencyHistogram m_Histograms[StageCount];
+};
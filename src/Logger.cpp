@@ -0,0 +1,181 @@
+#include "Logger.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <stdexcept>
+
+namespace {
+
+/// How long the writer sleeps when the ring is empty.
+constexpr std::chrono::milliseconds IdleInterval(10);
+
+}
+
+Logger &Logger::instance() {
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger() : m_Level(Info), m_Tail(0), m_Head(0), m_Dropped(0), m_ReportedDropped(0), m_Running(true) {
+    for (size_t i = 0; i < SlotCount; i++) {
+        m_Slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    m_Thread = std::thread([this]() {
+        while (m_Running) {
+            if (drain() == 0) {
+                std::this_thread::sleep_for(IdleInterval);
+            }
+        }
+
+        drain();
+    });
+}
+
+Logger::~Logger() {
+    m_Running = false;
+
+    if (m_Thread.joinable()) {
+        m_Thread.join();
+    }
+}
+
+void Logger::log(Level level, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vlog(level, format, args);
+    va_end(args);
+}
+
+void Logger::vlog(Level level, const char *format, va_list args) {
+    if (!isEnabled(level)) {
+        return;
+    }
+
+    // bounded multi producer ring: a slot is free for position pos when its sequence equals pos
+    size_t pos = m_Tail.load(std::memory_order_relaxed);
+    Slot *slot;
+
+    while (true) {
+        slot = &m_Slots[pos % SlotCount];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        auto diff = static_cast<std::ptrdiff_t>(sequence - pos);
+
+        if (diff == 0) {
+            if (m_Tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // the writer is behind, losing a message beats blocking the caller
+            m_Dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = m_Tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->level = level;
+    slot->time = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    vsnprintf(slot->text, TextSize, format, args);
+
+    slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+size_t Logger::drain() {
+    size_t written = 0;
+
+    while (true) {
+        Slot &slot = m_Slots[m_Head % SlotCount];
+
+        if (slot.sequence.load(std::memory_order_acquire) != m_Head + 1) {
+            break;
+        }
+
+        time_t seconds = static_cast<time_t>(slot.time / 1000000);
+        struct tm local;
+        localtime_r(&seconds, &local);
+
+        char stamp[16];
+        strftime(stamp, sizeof(stamp), "%H:%M:%S", &local);
+
+        FILE *out = slot.level >= Warning ? stderr : stdout;
+        fprintf(out, "%s.%03d %-7s %s\n", stamp, static_cast<int>(slot.time / 1000 % 1000), levelName(slot.level),
+                slot.text);
+
+        // hand the slot back to the producers one lap ahead
+        slot.sequence.store(m_Head + SlotCount, std::memory_order_release);
+        m_Head++;
+        written++;
+    }
+
+    uint64_t dropped = getDropped();
+
+    if (dropped != m_ReportedDropped) {
+        fprintf(stderr, "%llu log messages dropped\n", static_cast<unsigned long long>(dropped - m_ReportedDropped));
+        m_ReportedDropped = dropped;
+        written++;
+    }
+
+    if (written > 0) {
+        fflush(stdout);
+        fflush(stderr);
+    }
+
+    return written;
+}
+
+void Logger::debug(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    instance().vlog(Debug, format, args);
+    va_end(args);
+}
+
+void Logger::info(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    instance().vlog(Info, format, args);
+    va_end(args);
+}
+
+void Logger::warning(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    instance().vlog(Warning, format, args);
+    va_end(args);
+}
+
+void Logger::error(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    instance().vlog(Error, format, args);
+    va_end(args);
+}
+
+Logger::Level Logger::parseLevel(const std::string &name) {
+    for (int i = Debug; i <= Off; i++) {
+        if (name == levelName(static_cast<Level>(i))) {
+            return static_cast<Level>(i);
+        }
+    }
+    throw std::invalid_argument("unknown log level '" + name + "'");
+}
+
+const char *Logger::levelName(Level level) {
+    switch (level) {
+        case Debug:
+            return "debug";
+        case Info:
+            return "info";
+        case Warning:
+            return "warning";
+        case Error:
+            return "error";
+        case Off:
+            return "off";
+        default:
+            return "?";
+    }
+}
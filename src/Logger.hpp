@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+/// Process wide asynchronous logger.
+///
+/// Callers format their message into a preallocated slot of a bounded multi producer ring and return, a background
+/// thread adds time and level and does the blocking write. A full ring drops the message instead of waiting,
+/// so logging never stalls the control path. Warnings and errors go to stderr, everything else to stdout.
+class Logger {
+public:
+    enum Level {
+        Debug,
+        Info,
+        Warning,
+        Error,
+        Off
+    };
+
+    static Logger &instance();
+
+    /// Messages below the level are discarded before formatting.
+    void setLevel(Level level) {
+        m_Level.store(level, std::memory_order_relaxed);
+    }
+
+    Level getLevel() const {
+        return m_Level.load(std::memory_order_relaxed);
+    }
+
+    bool isEnabled(Level level) const {
+        return level >= getLevel();
+    }
+
+    /// Queue a printf style message, safe from any thread. Messages longer than a slot are truncated.
+    void log(Level level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+    void vlog(Level level, const char *format, va_list args);
+
+    static void debug(const char *format, ...) __attribute__((format(printf, 1, 2)));
+    static void info(const char *format, ...) __attribute__((format(printf, 1, 2)));
+    static void warning(const char *format, ...) __attribute__((format(printf, 1, 2)));
+    static void error(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+    /// Messages lost because the ring was full.
+    uint64_t getDropped() const {
+        return m_Dropped.load(std::memory_order_relaxed);
+    }
+
+    /// Parse "debug", "info", "warning", "error" or "off".
+    static Level parseLevel(const std::string &name);
+
+    static const char *levelName(Level level);
+
+private:
+    static constexpr size_t SlotCount = 512;
+    static constexpr size_t TextSize = 480;
+
+    struct Slot {
+        /// Ring position the slot is ready for, see push() and drain().
+        std::atomic<size_t> sequence;
+        Level level;
+        int64_t time;
+        char text[TextSize];
+    };
+
+    Logger();
+    ~Logger();
+
+    /// Write everything queued so far. Only called by the writer thread.
+    /// @return Number of written messages.
+    size_t drain();
+
+    std::atomic<Level> m_Level;
+
+    std::array<Slot, SlotCount> m_Slots;
+    std::atomic<size_t> m_Tail;
+    size_t m_Head;
+
+    std::atomic<uint64_t> m_Dropped;
+    uint64_t m_ReportedDropped;
+
+    std::atomic<bool> m_Running;
+    std::thread m_Thread;
+};
@@ -0,0 +1,126 @@
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+/// One registered series.
+struct Series {
+    const void *owner;
+    std::string labels;
+    bool counter;
+    std::function<double()> sample;
+};
+
+/// Series of one metric name.
+struct Family {
+    std::string help;
+    std::vector<Series> series;
+};
+
+struct Registry {
+    std::mutex mutex;
+    /// Sorted by name so scrapes come out in a stable order.
+    std::map<std::string, Family> families;
+};
+
+Registry &registry() {
+    static Registry instance;
+    return instance;
+}
+
+void registerSeries(const std::string &name, const std::string &help, Series series) {
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    Family &family = reg.families[name];
+    family.help = help;
+    family.series.push_back(std::move(series));
+}
+
+void unregisterSeries(const void *owner) {
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    for (auto it = reg.families.begin(); it != reg.families.end();) {
+        auto &series = it->second.series;
+        series.erase(std::remove_if(series.begin(), series.end(), [owner](const Series &s) {
+            return s.owner == owner;
+        }), series.end());
+
+        it = series.empty() ? reg.families.erase(it) : std::next(it);
+    }
+}
+
+}
+
+Metrics::Counter::Counter(const std::string &name, const std::string &help, const std::string &labels, double scale) {
+    registerSeries(name, help, Series{this, labels, true, [this, scale]() {
+        return static_cast<double>(value()) * scale;
+    }});
+}
+
+Metrics::Counter::~Counter() {
+    unregisterSeries(this);
+}
+
+uint64_t Metrics::Counter::value() const {
+    uint64_t sum = 0;
+
+    for (auto &shard : m_Shards) {
+        sum += shard.value.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+size_t Metrics::Counter::shard() {
+    static std::atomic<size_t> next(0);
+    thread_local size_t index = next.fetch_add(1, std::memory_order_relaxed) % ShardCount;
+    return index;
+}
+
+Metrics::Gauge::Gauge(const std::string &name, const std::string &help, const std::string &labels,
+                      std::function<double()> sample, bool counter) {
+    registerSeries(name, help, Series{this, labels, counter, std::move(sample)});
+}
+
+Metrics::Gauge::~Gauge() {
+    unregisterSeries(this);
+}
+
+std::string Metrics::render() {
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    std::string out;
+    char value[32];
+
+    for (auto &entry : reg.families) {
+        const Family &family = entry.second;
+
+        out += "# HELP " + entry.first + " " + family.help + "\n";
+        out += "# TYPE " + entry.first + (family.series.front().counter ? " counter\n" : " gauge\n");
+
+        for (auto &series : family.series) {
+            snprintf(value, sizeof(value), "%.15g", series.sample());
+
+            out += entry.first;
+            if (!series.labels.empty()) {
+                out += "{" + series.labels + "}";
+            }
+            out += " ";
+            out += value;
+            out += "\n";
+        }
+    }
+
+    return out;
+}
+
+const char *Metrics::contentType() {
+    return "text/plain; version=0.0.4";
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+/// Process wide counters and gauges in the Prometheus text exposition format.
+///
+/// Counters are usually static objects next to the code they count. Every counter is split into cache line sized
+/// shards and a thread always increments the same shard, so hot paths on different threads never share a line and
+/// an increment is a relaxed add. A scrape sums the shards. Gauges sample a callback at scrape time and live as long
+/// as the object they read from.
+class Metrics {
+public:
+    /// Monotonic count, rendered as value * scale.
+    class Counter {
+    public:
+        /// @param name Metric name, series of the same name are grouped under one HELP and TYPE line.
+        /// @param help Description for the HELP line.
+        /// @param labels Label set without braces, e.g. opcode="p", empty for none.
+        /// @param scale Factor applied when rendering, e.g. 1e-9 to count nanoseconds and expose seconds.
+        Counter(const std::string &name, const std::string &help, const std::string &labels = "", double scale = 1.0);
+
+        ~Counter();
+
+        Counter(const Counter &) = delete;
+        Counter &operator=(const Counter &) = delete;
+
+        void add(uint64_t amount = 1) {
+            m_Shards[shard()].value.fetch_add(amount, std::memory_order_relaxed);
+        }
+
+        uint64_t value() const;
+
+    private:
+        static constexpr size_t ShardCount = 16;
+
+        struct alignas(64) Shard {
+            std::atomic<uint64_t> value{0};
+        };
+
+        /// Shard of the calling thread, assigned round robin on first use.
+        static size_t shard();
+
+        std::array<Shard, ShardCount> m_Shards;
+    };
+
+    /// Value read from a callback whenever metrics are rendered.
+    class Gauge {
+    public:
+        /// @param counter Expose the sample as a counter, for totals kept elsewhere.
+        Gauge(const std::string &name, const std::string &help, const std::string &labels,
+              std::function<double()> sample, bool counter = false);
+
+        ~Gauge();
+
+        Gauge(const Gauge &) = delete;
+        Gauge &operator=(const Gauge &) = delete;
+    };
+
+    /// All registered series, grouped by name.
+    static std::string render();
+
+    /// Content type of render() for the HTTP response.
+    static const char *contentType();
+};
@@ -0,0 +1,183 @@
+#include "MotorCommands.hpp"
+
+#include "Logger.hpp"
+#include "MotorController.hpp"
+
+#include <charconv>
+#include <stdexcept>
+
+namespace {
+
+/// Name of a lens command value for the log.
+const char *lensDirection(int value) {
+    return value == 0 ? "stop" : (value == 1 ? "left" : "right");
+}
+
+/// Lens drive speed for 0 - stop, 1 - left, 2 - right.
+/// @return False for other values, which are ignored.
+bool lensVector(int value, int &vector) {
+    switch (value) {
+        case 0:
+            vector = 0;
+            return true;
+        case 1:
+            vector = 100;
+            return true;
+        case 2:
+            vector = -100;
+            return true;
+        default:
+            return false;
+    }
+}
+
+/// Parse "X,Y" without allocating, the tracking offsets arrive at frame rate.
+bool parsePair(const std::string &argument, int &x, int &y) {
+    const char *end = argument.data() + argument.size();
+    auto first = std::from_chars(argument.data(), end, x);
+
+    if (first.ec != std::errc() || first.ptr == end || *first.ptr != ',') {
+        return false;
+    }
+
+    auto second = std::from_chars(first.ptr + 1, end, y);
+    return second.ec == std::errc() && second.ptr == end;
+}
+
+}
+
+void MotorCommands::pitch(MotorController &motors, int value, const CommandReply &reply) {
+    Logger::debug("setting Pitch %d", value);
+    if (motors.isHoming()) {
+        if (reply) {
+            reply("Ehoming in progress");
+        }
+        return;
+    }
+    motors.setPitch(value);
+}
+
+void MotorCommands::yaw(MotorController &motors, int value, const CommandReply &reply) {
+    Logger::debug("setting Yaw %d", value);
+    if (motors.isHoming()) {
+        if (reply) {
+            reply("Ehoming in progress");
+        }
+        return;
+    }
+    motors.setYaw(value);
+}
+
+void MotorCommands::focus(MotorController &motors, int value, const CommandReply &) {
+    Logger::debug("setting Focus %s", lensDirection(value));
+    int vector;
+    if (lensVector(value, vector)) {
+        motors.setFocus(vector);
+    }
+}
+
+void MotorCommands::zoom(MotorController &motors, int value, const CommandReply &) {
+    Logger::debug("setting Zoom %s", lensDirection(value));
+    int vector;
+    if (lensVector(value, vector)) {
+        motors.setZoom(vector);
+    }
+}
+
+void MotorCommands::irCut(MotorController &motors, int value, const CommandReply &) {
+    Logger::debug("setting IR %d", value);
+    motors.setIR(value > 0);
+}
+
+void MotorCommands::savePreset(MotorController &motors, const std::string &name, const CommandReply &reply) {
+    Logger::debug("saving preset %s", name.c_str());
+    try {
+        motors.savePreset(name);
+    }
+    catch (std::exception &ex) {
+        Logger::warning("Cannot save preset, error '%s'.", ex.what());
+        if (reply) {
+            reply(std::string("E") + ex.what());
+        }
+    }
+}
+
+void MotorCommands::recallPreset(MotorController &motors, const std::string &name, const CommandReply &reply) {
+    Logger::debug("recalling preset %s", name.c_str());
+    // a recall would take over the axes from the homing seeks
+    if (motors.isHoming()) {
+        if (reply) {
+            reply("Ehoming in progress");
+        }
+        return;
+    }
+    if (!motors.recallPreset(name) && reply) {
+        reply("Eunknown preset");
+    }
+}
+
+void MotorCommands::deletePreset(MotorController &motors, const std::string &name, const CommandReply &reply) {
+    Logger::debug("deleting preset %s", name.c_str());
+    try {
+        if (!motors.deletePreset(name) && reply) {
+            reply("Eunknown preset");
+        }
+    }
+    catch (std::exception &ex) {
+        Logger::warning("Cannot delete preset, error '%s'.", ex.what());
+        if (reply) {
+            reply(std::string("E") + ex.what());
+        }
+    }
+}
+
+void MotorCommands::home(MotorController &motors, int, const CommandReply &reply) {
+    Logger::debug("homing");
+    // homing waits on wall time while a simulated clock only moves with the replay, the moves would never finish
+    if (motors.isSimulated()) {
+        if (reply) {
+            reply("Ehoming needs wall clock time");
+        }
+        return;
+    }
+
+    bool started = motors.startHoming([reply](std::pair<int, int> travel, const std::string &error) {
+        if (!error.empty()) {
+            Logger::warning("Homing failed, error '%s'.", error.c_str());
+            if (reply) {
+                reply("E" + error);
+            }
+            return;
+        }
+
+        Logger::info("Homed, travel pitch %d yaw %d", travel.first, travel.second);
+        if (reply) {
+            reply("H" + std::to_string(travel.first) + "," + std::to_string(travel.second));
+        }
+    });
+
+    if (!started && reply) {
+        reply("Ehoming in progress");
+    }
+}
+
+void MotorCommands::track(MotorController &motors, const std::string &argument, const CommandReply &reply) {
+    if (argument.empty()) {
+        Logger::debug("tracking off");
+        motors.stopTracking();
+        return;
+    }
+
+    int x, y;
+    if (!parsePair(argument, x, y)) {
+        if (reply) {
+            reply("Einvalid offset");
+        }
+        return;
+    }
+
+    Logger::debug("tracking offset %d,%d", x, y);
+    if (!motors.track(x / 1000.0, y / 1000.0) && reply) {
+        reply("Etracking needs wall time");
+    }
+}
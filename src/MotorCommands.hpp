@@ -0,0 +1,52 @@
+#pragma once
+
+#include "CommandRouter.hpp"
+
+/// Text command handlers of the pan/tilt axes and the lens.
+namespace MotorCommands {
+
+/// "pX" pitch vector X = [-100,100], "Ehoming in progress" while homing runs
+void pitch(MotorController &motors, int value, const CommandReply &reply);
+
+/// "yX" yaw vector X = [-100,100], "Ehoming in progress" while homing runs
+void yaw(MotorController &motors, int value, const CommandReply &reply);
+
+/// "fX" focus X = 0 - stop, 1 - left, 2 - right
+void focus(MotorController &motors, int value, const CommandReply &reply);
+
+/// "zX" zoom X = 0 - stop, 1 - left, 2 - right
+void zoom(MotorController &motors, int value, const CommandReply &reply);
+
+/// "iX" ir cut filter X = 0 - off, 1 - on
+void irCut(MotorController &motors, int value, const CommandReply &reply);
+
+/// "sNAME" store the current shot as preset NAME
+void savePreset(MotorController &motors, const std::string &name, const CommandReply &reply);
+
+/// "gNAME" go to preset NAME, "Ehoming in progress" while homing runs
+void recallPreset(MotorController &motors, const std::string &name, const CommandReply &reply);
+
+/// "dNAME" delete preset NAME
+void deletePreset(MotorController &motors, const std::string &name, const CommandReply &reply);
+
+/// "tX,Y" subject offset from the frame centre in 1/1000 of half the frame width, "t" alone ends tracking
+void track(MotorController &motors, const std::string &argument, const CommandReply &reply);
+
+/// "H" find the end-stops of both axes, answers "HP,Y" with the travel in half steps or "E..." once done.
+/// Refused with "E..." on a simulated clock.
+void home(MotorController &motors, int value, const CommandReply &reply);
+
+constexpr CommandBinding Bindings[] = {
+        {'p', &pitch, true, nullptr},
+        {'y', &yaw, true, nullptr},
+        {'f', &focus, true, nullptr},
+        {'z', &zoom, true, nullptr},
+        {'i', &irCut, true, nullptr},
+        {'s', nullptr, false, &savePreset},
+        {'g', nullptr, true, &recallPreset},
+        {'d', nullptr, false, &deletePreset},
+        {'H', &home, true, nullptr},
+        {'t', nullptr, true, &track}
+};
+
+}
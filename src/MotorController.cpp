@@ -1,87 +1,472 @@
 #include "MotorController.hpp"
 #include <boost/filesystem.hpp>
 #include <future>
+#include <stdexcept>
+#include <thread>
 
+#include "EndStop.hpp"
 #include "Focuser.hpp"
 
-#if RASPI == 1
-#include <wiringPi.h>
+#include "PresetStore.hpp"
+#include "StepEngine.hpp"
 #include "StepperMotor.hpp"
 
-#else
-// fake class
-class StepperMotor
+// fastest stepper profile, 5 ms per half step
+static const int FullSpeed = 100;
+
+// homing: slow approach for a repeatable switch edge, 50 ms per half step
+static const int ApproachSpeed = 10;
+// half steps to leave a switch before the slow approach
+static const int Backoff = 64;
+// longest travel a seek may take, two output turns of the 28BYJ-48
+static const int MaxTravel = 8192;
+// stay this far inside the switches after homing
+static const int LimitMargin = 16;
+// switch bounce and interrupt latency on top of the step budget of a phase
+static const std::chrono::milliseconds Debounce(20);
+static const std::chrono::milliseconds Slack(200);
+#if RASPI != 1
+// physical travel between the simulated end-stops, centred on the power-on position
+static const int SimulatedTravel = 4000;
+#endif
+
+// FNV-1a over the pins and the lens address, persisted state only goes back to the head it came from
+static uint32_t wiringHash(const RigConfig& config)
 {
-public:
-    void setGPIOutputs(int, int, int, int) {};
-    bool isRunning() const
+    uint32_t hash = 2166136261u;
+    auto mix = [&hash](int value)
     {
-        return false;
-    }
-    unsigned getThreshold() const
+        hash = (hash ^ static_cast<uint32_t>(value)) * 16777619u;
+    };
+
+    for(unsigned pin : config.pitchPins)
+        mix(pin);
+    for(unsigned pin : config.yawPins)
+        mix(pin);
+    for(int pin : config.pitchEndStops)
+        mix(pin);
+    for(int pin : config.yawEndStops)
+        mix(pin);
+    mix(config.lensAddress);
+    return hash;
+}
+
+static std::unique_ptr<EndStop> makeEndStop(int pin, std::shared_ptr<StepperMotor> motor, int direction)
+{
+    if(pin < 0)
+        return nullptr;
+
+    std::unique_ptr<EndStop> stop(new EndStop(pin));
+    // hard stop whenever the axis runs into the switch, moving away from it stays possible
+    stop->setOnClosed([motor, direction]()
     {
-        return 0;
-    }
-    int getCurrentPosition() const
+        if(motor->getVector() * direction > 0)
+            motor->run_async(0);
+    });
+    return stop;
+}
+
+static std::chrono::milliseconds travelTime(StepperMotor& motor, int steps, int speed)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(motor.period(speed) * std::abs(steps)) + Slack;
+}
+
+// Move by delta half steps and wait for the arrival
+static void moveBy(StepperMotor& motor, int delta, int speed)
+{
+    motor.run_to(motor.getStepPosition() + delta, speed);
+
+    auto deadline = std::chrono::steady_clock::now() + travelTime(motor, delta, speed);
+    std::this_thread::sleep_for(motor.period(speed) * std::abs(delta));
+    while(motor.isTargeting())
     {
-        return 0;
+        if(std::chrono::steady_clock::now() > deadline)
+        {
+            motor.run_async(0);
+            throw std::runtime_error("axis did not finish a homing move in time");
+        }
+        std::this_thread::sleep_for(motor.period(speed));
     }
-    unsigned getSteps(unsigned angle) const
-    {
-        return 0;
-    };
-    unsigned getNumOfSteps() const
+}
+
+// Run towards the switch for at most budget half steps and return the position it closed at
+static int seek(StepperMotor& motor, EndStop& stop, int direction, int speed, int budget)
+{
+    stop.arm();
+    if(!stop.isClosed())
     {
-        return 0;
+        motor.run_to(motor.getStepPosition() + direction * budget, speed);
+        if(!stop.waitClosed(travelTime(motor, budget, speed)))
+        {
+            motor.run_async(0);
+            throw std::runtime_error("end-stop on pin " + std::to_string(stop.getPin()) + " not reached");
+        }
     }
-    void setGPIOutputs(unsigned in1, unsigned in2, unsigned in3, unsigned in4) {};
-    void setThreshold(unsigned threshold) {};
-    void run(int direction, unsigned angle, unsigned speed) {};
-    void wait(unsigned milliseconds) const {};
+    // the interrupt handler already stopped the axis, before the next step was due
+    motor.run_async(0);
+    return motor.getStepPosition();
+}
 
-    void run_async(int vector) {};
-};
-#endif
+// Fast seek, back off and slow approach, returns the position of the switch edge
+static int findEdge(StepperMotor& motor, EndStop& stop, int direction)
+{
+    if(stop.isClosed())
+        moveBy(motor, -direction * Backoff, FullSpeed);
+    seek(motor, stop, direction, FullSpeed, MaxTravel);
+
+    moveBy(motor, -direction * Backoff, FullSpeed);
+    std::this_thread::sleep_for(Debounce);
+    if(stop.isClosed())
+        throw std::runtime_error("end-stop on pin " + std::to_string(stop.getPin()) + " does not open");
+
+    return seek(motor, stop, direction, ApproachSpeed, 2 * Backoff);
+}
 
-MotorController::MotorController()
+// Home one axis and return its travel between the switch edges
+static int homeAxis(StepperMotor& motor, EndStop* minStop, EndStop* maxStop)
 {
-#if RASPI == 1
-    wiringPiSetup();
-#endif
+    if(!minStop || !maxStop)
+        throw std::runtime_error("homing needs a min and a max end-stop on every axis");
 
+    motor.clearSoftLimits();
+    motor.shiftPosition(findEdge(motor, *minStop, -1));
+    int travel = findEdge(motor, *maxStop, 1);
+    if(travel <= 2 * LimitMargin)
+        throw std::runtime_error("end-stops on pins " + std::to_string(minStop->getPin()) + " and " +
+                                 std::to_string(maxStop->getPin()) + " are too close together");
+
+    motor.setSoftLimits(LimitMargin, travel - LimitMargin);
+    motor.run_to(travel / 2, FullSpeed);
+    return travel;
+}
+
+MotorController::MotorController(const RigConfig& config, StepEngine& engine, PresetStore& presets, unsigned id)
+    : m_Engine(engine), m_Presets(presets), m_Id(id), m_Wiring(wiringHash(config)), m_LensPending(false),
+      m_LensMoving(false), m_LensQuit(false), m_HomingActive(false), m_Homed(false)
+{
     m_Stepper1 = std::make_shared<StepperMotor>();
     m_Stepper2 = std::make_shared<StepperMotor>();
-    m_Focuser = std::make_shared<Focuser>();
+    m_Focuser = std::make_shared<Focuser>(config.lensAddress, engine.getClock());
 
-    // Yaw Motor
-    m_Stepper1->setGPIOutputs(7, 0, 2, 3);
     // Pitch Motor
-    m_Stepper2->setGPIOutputs(22, 23, 24, 25);
+    m_Stepper1->setGPIOutputs(config.pitchPins[0], config.pitchPins[1], config.pitchPins[2], config.pitchPins[3]);
+    // Yaw Motor
+    m_Stepper2->setGPIOutputs(config.yawPins[0], config.yawPins[1], config.yawPins[2], config.yawPins[3]);
+
+    m_Stepper1->setBacklash(config.backlash[0]);
+    m_Stepper2->setBacklash(config.backlash[1]);
+
+    m_Stepper1->setResonanceBands(config.resonance[0]);
+    m_Stepper2->setResonanceBands(config.resonance[1]);
+    m_Stepper1->setResponseCurve(ResponseCurve(config.response[0]));
+    m_Stepper2->setResponseCurve(ResponseCurve(config.response[1]));
+
+    m_Tracker.reset(new Tracker(m_Stepper1, m_Stepper2, m_Focuser, config.tracking));
+
+    m_PitchMin = makeEndStop(config.pitchEndStops[0], m_Stepper1, -1);
+    m_PitchMax = makeEndStop(config.pitchEndStops[1], m_Stepper1, 1);
+    m_YawMin = makeEndStop(config.yawEndStops[0], m_Stepper2, -1);
+    m_YawMax = makeEndStop(config.yawEndStops[1], m_Stepper2, 1);
+
+#if RASPI != 1
+    m_Stepper1->simulateEndStops(config.pitchEndStops[0], -SimulatedTravel / 2, config.pitchEndStops[1], SimulatedTravel / 2);
+    m_Stepper2->simulateEndStops(config.yawEndStops[0], -SimulatedTravel / 2, config.yawEndStops[1], SimulatedTravel / 2);
+#endif
+
+    m_Engine.add(m_Stepper1);
+    m_Engine.add(m_Stepper2);
+
+    m_LensWorker = std::thread(&MotorController::runLens, this);
 }
 
 MotorController::~MotorController()
 {
+    // release a running homing and tracking before the axes go away
+    cancelHoming();
+    m_Tracker->stop();
+
+    {
+        std::lock_guard<std::mutex> lock(m_LensMutex);
+        m_LensQuit = true;
+    }
+    m_LensChanged.notify_one();
+    m_LensWorker.join();
+
+    m_Engine.remove(m_Stepper1);
+    m_Engine.remove(m_Stepper2);
 }
 
 void MotorController::setPitch(int vector)
 {
-    m_Stepper1->run_async(vector);
+    if(m_HomingActive)
+        return;
+    m_Tracker->stop();
+    m_Stepper1->jog(vector);
 }
 
 void MotorController::setYaw(int vector)
 {
-    m_Stepper2->run_async(vector);
+    if(m_HomingActive)
+        return;
+    m_Tracker->stop();
+    m_Stepper2->jog(vector);
 }
 
+// lens changes do not step, wake the engine so its pass persists them
 void MotorController::setFocus(int vector)
 {
+    if(changeLensTarget([vector](LensTarget& target) { target.focus += vector; }))
+        return;
     m_Focuser->setFocus(vector, true);
+    m_Engine.wake();
 }
 void MotorController::setZoom(int vector)
 {
+    if(changeLensTarget([vector](LensTarget& target) { target.zoom += vector; }))
+        return;
     m_Focuser->setZoom(vector, true);
+    m_Engine.wake();
 }
 void MotorController::setIR(bool vector)
 {
+    if(changeLensTarget([vector](LensTarget& target) { target.irCut = vector; }))
+        return;
     m_Focuser->setIRCut(vector, true);
+    m_Engine.wake();
+}
+
+void MotorController::stop()
+{
+    m_Tracker->stop();
+    m_Stepper1->run_async(0);
+    m_Stepper2->run_async(0);
+}
+
+void MotorController::stopJogging()
+{
+    m_Tracker->stop();
+    if(!m_Stepper1->isTargeting())
+        m_Stepper1->run_async(0);
+    if(!m_Stepper2->isTargeting())
+        m_Stepper2->run_async(0);
+}
+
+void MotorController::savePreset(const std::string& name)
+{
+    RigState state = getState();
+
+    Preset preset;
+    preset.pitchPosition = state.pitchPosition;
+    preset.yawPosition = state.yawPosition;
+    preset.focus = state.focus;
+    preset.zoom = state.zoom;
+    preset.irCut = state.irCut;
+
+    m_Presets.set(m_Id, name, preset);
+}
+
+bool MotorController::recallPreset(const std::string& name)
+{
+    Preset preset;
+    if(!m_Presets.get(m_Id, name, preset))
+        return false;
+
+    m_Tracker->stop();
+
+    // Every axis has its own drive, so the shot is reached when the slowest axis arrives on its own.
+    // Pan and tilt both run at full speed and the lens driver moves at the same time, which no other
+    // ordering beats. Steppers first, they are cheap to start and the lens call blocks for the whole move.
+    m_Stepper1->run_to(preset.pitchPosition, FullSpeed);
+    m_Stepper2->run_to(preset.yawPosition, FullSpeed);
+
+    // the lens worker picks the target up, the caller does not wait for a lens move of an earlier recall
+    {
+        std::lock_guard<std::mutex> lock(m_LensMutex);
+        m_LensTarget.focus = preset.focus;
+        m_LensTarget.zoom = preset.zoom;
+        m_LensTarget.irCut = preset.irCut;
+        m_LensPending = true;
+    }
+    m_LensChanged.notify_one();
+    return true;
+}
+
+void MotorController::runLens()
+{
+    std::unique_lock<std::mutex> lock(m_LensMutex);
+    for(;;)
+    {
+        m_LensChanged.wait(lock, [this]() { return m_LensPending || m_LensQuit; });
+        if(m_LensQuit)
+            return;
+
+        LensTarget target = m_LensTarget;
+        m_LensPending = false;
+        m_LensMoving = true;
+
+        // moveTo blocks for the whole lens travel, later recalls and nudges only change the target meanwhile
+        lock.unlock();
+        m_Focuser->moveTo(target.focus, target.zoom, target.irCut);
+        m_Engine.wake();
+        lock.lock();
+        m_LensMoving = false;
+    }
+}
+
+bool MotorController::changeLensTarget(const std::function<void(LensTarget&)>& change)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_LensMutex);
+        if(!m_LensPending && !m_LensMoving)
+            return false;
+
+        // the target still holds the values of the move in flight, the next move continues from there
+        change(m_LensTarget);
+        m_LensPending = true;
+    }
+    m_LensChanged.notify_one();
+    return true;
+}
+
+bool MotorController::track(double x, double y)
+{
+    if(isSimulated())
+        return false;
+
+    m_Tracker->update(x, y);
+    return true;
+}
+
+void MotorController::stopTracking()
+{
+    m_Tracker->stop();
+}
+
+bool MotorController::isTracking() const
+{
+    return m_Tracker->isTracking();
+}
+
+bool MotorController::deletePreset(const std::string& name)
+{
+    return m_Presets.remove(m_Id, name);
+}
+
+std::pair<int, int> MotorController::home()
+{
+    m_Tracker->stop();
+    m_Homed = false;
+    m_HomingActive = true;
+
+    int pitchTravel, yawTravel;
+    try
+    {
+        // both axes at once, each blocks on its own switches
+        auto pitch = std::async(std::launch::async, homeAxis, std::ref(*m_Stepper1), m_PitchMin.get(),
+                                m_PitchMax.get());
+        // if yaw fails the future waits for pitch while unwinding
+        yawTravel = homeAxis(*m_Stepper2, m_YawMin.get(), m_YawMax.get());
+        pitchTravel = pitch.get();
+    }
+    catch(...)
+    {
+        m_HomingActive = false;
+        throw;
+    }
+
+    m_HomingActive = false;
+    m_Homed = true;
+    m_Engine.wake();
+    return std::make_pair(pitchTravel, yawTravel);
+}
+
+bool MotorController::isSimulated() const
+{
+    return m_Engine.getClock()->isSimulated();
+}
+
+bool MotorController::startHoming(std::function<void(std::pair<int, int> travel, const std::string& error)> done)
+{
+    std::lock_guard<std::mutex> lock(m_HomingMutex);
+    if(m_Homing.valid() && m_Homing.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return false;
+
+    m_Homing = std::async(std::launch::async, [this, done]()
+    {
+        try
+        {
+            done(home(), std::string());
+        }
+        catch(const std::exception& e)
+        {
+            done(std::make_pair(0, 0), e.what());
+        }
+    });
+    return true;
+}
+
+void MotorController::cancelHoming()
+{
+    for(EndStop* stop : {m_PitchMin.get(), m_PitchMax.get(), m_YawMin.get(), m_YawMax.get()})
+    {
+        if(stop)
+            stop->cancel();
+    }
+    std::lock_guard<std::mutex> lock(m_HomingMutex);
+    if(m_Homing.valid())
+        m_Homing.wait();
+}
+
+PersistentState::Rig MotorController::getPersisted() const
+{
+    PersistentState::Rig rig = {};
+    rig.pitchPosition = m_Stepper1->getStepPosition();
+    rig.yawPosition = m_Stepper2->getStepPosition();
+    rig.pitchPhase = static_cast<uint8_t>(m_Stepper1->getPhase());
+    rig.yawPhase = static_cast<uint8_t>(m_Stepper2->getPhase());
+    if(m_Stepper1->getSoftLimits(rig.pitchMin, rig.pitchMax))
+        rig.flags |= PersistentState::PitchLimited;
+    if(m_Stepper2->getSoftLimits(rig.yawMin, rig.yawMax))
+        rig.flags |= PersistentState::YawLimited;
+    rig.focus = m_Focuser->getFocus();
+    rig.zoom = m_Focuser->getZoom();
+    if(m_Focuser->getIRCut())
+        rig.flags |= PersistentState::IrCut;
+    if(m_Homed)
+        rig.flags |= PersistentState::Homed;
+    rig.wiring = m_Wiring;
+    return rig;
+}
+
+bool MotorController::restore(const PersistentState::Rig& rig)
+{
+    if(rig.wiring != m_Wiring)
+        return false;
+
+    m_Stepper1->shiftPosition(m_Stepper1->getStepPosition() - rig.pitchPosition);
+    m_Stepper2->shiftPosition(m_Stepper2->getStepPosition() - rig.yawPosition);
+    // energizing any other phase first would snap the rotors up to 4 half steps away from the resumed count
+    m_Stepper1->setPhase(rig.pitchPhase);
+    m_Stepper2->setPhase(rig.yawPhase);
+    if(rig.flags & PersistentState::PitchLimited)
+        m_Stepper1->setSoftLimits(rig.pitchMin, rig.pitchMax);
+    if(rig.flags & PersistentState::YawLimited)
+        m_Stepper2->setSoftLimits(rig.yawMin, rig.yawMax);
+    m_Focuser->restore(rig.focus, rig.zoom, (rig.flags & PersistentState::IrCut) != 0);
+    m_Homed = (rig.flags & PersistentState::Homed) != 0;
+    return true;
+}
+
+RigState MotorController::getState() const
+{
+    RigState state;
+    state.pitchPosition = m_Stepper1->getStepPosition();
+    state.yawPosition = m_Stepper2->getStepPosition();
+    state.pitchVector = m_Stepper1->getVector();
+    state.yawVector = m_Stepper2->getVector();
+    state.focus = m_Focuser->getFocus();
+    state.zoom = m_Focuser->getZoom();
+    state.irCut = m_Focuser->getIRCut();
+    state.busy = m_Focuser->wasBusy();
+    return state;
 }
@@ -1,22 +1,149 @@
 #pragma once
 #include <thread>
 #include <atomic>
+#include <memory>
+#include <array>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <vector>
+#include <functional>
+#include "PersistentState.hpp"
+#include "ResponseCurve.hpp"
+#include "Tracker.hpp"
 class StepperMotor;
+class StepEngine;
 class Focuser;
+class PresetStore;
+class EndStop;
+
+// Wiring of one pan/tilt head
+struct RigConfig
+{
+    std::array<unsigned, 4> pitchPins;  // wiringPi numbers of the ULN2003 inputs
+    std::array<unsigned, 4> yawPins;
+    int lensAddress;                    // I2C address of the lens driver
+    std::array<int, 2> pitchEndStops;   // wiringPi numbers of the min and max limit switches, -1 if not fitted
+    std::array<int, 2> yawEndStops;
+    std::array<unsigned, 2> backlash;   // gear slack of pitch and yaw in half steps, 0 if not compensated
+    std::array<ResponseCurve::Shape, 2> response;   // velocity response of pitch and yaw to operator commands
+    std::array<std::vector<ResponseCurve::Band>, 2> resonance;  // step rates pitch and yaw never cruise at
+    Tracker::Config tracking;           // visual servo gains and lens geometry
+};
+
+// Snapshot of all axes, cheap enough to take at telemetry rate
+struct RigState
+{
+    int pitchPosition;  // half steps since power-on, from the min end-stop once homed
+    int yawPosition;    // half steps since power-on, from the min end-stop once homed
+    int pitchVector;    // [-100,100]
+    int yawVector;      // [-100,100]
+    int focus;
+    int zoom;
+    bool irCut;
+    bool busy;          // lens driver busy
+};
 
 class MotorController
 {
 public:
-    MotorController();
+    // Drive the head wired as configured, its steppers run on the shared engine.
+    // Presets of the head are kept in the store under its id.
+    MotorController(const RigConfig& config, StepEngine& engine, PresetStore& presets, unsigned id);
     ~MotorController();
 
+    // Operator velocity [-100,100], shaped by the response curve of the axis. Ignored while homing runs, the
+    // seeks own the axes then and a jog would end them early or move the zero.
     void setPitch(int vector);
     void setYaw(int vector);
 
     void setFocus(int vector);
     void setZoom(int vector);
     void setIR(bool vector);
+
+    // Stop all stepper axes immediately, ends tracking
+    void stop();
+
+    // Stop the axes jogged by velocity or tracking, moves to a preset run to the end
+    void stopJogging();
+
+    // Report the subject offset from the frame centre in units of half the frame width, x towards positive yaw
+    // and y towards positive pitch. The first report starts tracking, it ends when reports stop coming or any
+    // other stepper command arrives. False on a simulated clock, the loop runs on wall time.
+    bool track(double x, double y);
+
+    void stopTracking();
+
+    bool isTracking() const;
+
+    // Store the current shot, throws std::invalid_argument for a bad name and std::runtime_error if it cannot be saved
+    void savePreset(const std::string& name);
+
+    // Move all four axes to a stored shot at once, false if there is no such preset
+    bool recallPreset(const std::string& name);
+
+    // False if there is no such preset, throws std::runtime_error if the store cannot be saved
+    bool deletePreset(const std::string& name);
+
+    // Find the end-stops of both axes at the same time: seek the min switch at full speed, back off, approach it
+    // again slowly for a repeatable edge and make it position 0, then the same for the max switch. Afterwards
+    // travel is limited to just inside the switches and the head parks in the middle. Every phase has a step
+    // budget, so homing fails instead of hanging if a switch is missing.
+    // Returns the travel of pitch and yaw in half steps, throws std::runtime_error if an axis has no end-stops,
+    // a switch is not reached in time or homing was cancelled. Runs on wall time.
+    std::pair<int, int> home();
+
+    // True if the engine runs on a simulated clock, as in replays. Homing and tracking need wall time there.
+    bool isSimulated() const;
+
+    // Run home() on a thread of its own and report the result to done, false if homing is already running
+    bool startHoming(std::function<void(std::pair<int, int> travel, const std::string& error)> done);
+
+    // Fail a running homing and wait for it, homing stays unavailable afterwards. Called on shutdown
+    // while the connection that asked for it can still take the answer.
+    void cancelHoming();
+
+    // True while home() runs
+    bool isHoming() const
+    {
+        return m_HomingActive;
+    }
+
+    // True once home() succeeded
+    bool isHomed() const
+    {
+        return m_Homed;
+    }
+
+    // Positions, lens values and calibration to persist, cheap enough for every engine pass
+    PersistentState::Rig getPersisted() const;
+
+    // Resume from persisted state while the head is idle, false if it was saved for a differently wired head
+    bool restore(const PersistentState::Rig& rig);
+
+    // Lock-free snapshot of positions, velocities and lens values
+    RigState getState() const;
 private:
+    // Lens values of a preset recall
+    struct LensTarget
+    {
+        int focus;
+        int zoom;
+        bool irCut;
+    };
+
+    // Body of m_LensWorker: drive the lens to the latest target until the controller goes away
+    void runLens();
+
+    // Apply change to the target of a recall whose lens move is pending or running, so an operator nudge replaces
+    // it instead of waiting behind it. False if the lens is idle, the nudge goes to the driver directly then.
+    bool changeLensTarget(const std::function<void(LensTarget&)>& change);
+
+    StepEngine& m_Engine;
+    PresetStore& m_Presets;
+    unsigned m_Id;
+    uint32_t m_Wiring;
 
     // Stepper motor handle
     std::shared_ptr<StepperMotor> m_Stepper1;
@@ -24,4 +151,27 @@ private:
 
     // Focuser handle
     std::shared_ptr<Focuser> m_Focuser;
+
+    // visual servo driving both steppers while tracking
+    std::unique_ptr<Tracker> m_Tracker;
+
+    // lens part of preset recalls, runs next to the stepper moves. A recall only leaves its target here, one that
+    // comes while the lens is still moving replaces the target of any recall that has not started yet.
+    std::thread m_LensWorker;
+    std::mutex m_LensMutex;
+    std::condition_variable m_LensChanged;
+    LensTarget m_LensTarget;
+    bool m_LensPending;
+    bool m_LensMoving;
+    bool m_LensQuit;
+
+    // limit switches, empty if not fitted
+    std::unique_ptr<EndStop> m_PitchMin, m_PitchMax;
+    std::unique_ptr<EndStop> m_YawMin, m_YawMax;
+
+    // background homing started by startHoming(), guarded by m_HomingMutex as any dispatching thread may start it
+    std::mutex m_HomingMutex;
+    std::future<void> m_Homing;
+    std::atomic<bool> m_HomingActive;
+    std::atomic<bool> m_Homed;
 };
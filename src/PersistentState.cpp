@@ -0,0 +1,141 @@
+#include "PersistentState.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr size_t PersistentState::MaxRigs;
+
+namespace {
+
+const char Magic[4] = {'R', 'S', 'S', 'T'};
+const char Version = 1;
+
+/// FNV-1a, enough to tell a torn slot from a written one.
+uint32_t fnv(const void *data, size_t size, uint32_t hash = 2166136261u) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+}
+
+PersistentState::PersistentState() : m_File(nullptr), m_Sequence(0) {
+}
+
+PersistentState::~PersistentState() {
+    if (m_File) {
+        munmap(m_File, sizeof(File));
+    }
+}
+
+void PersistentState::open(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open state file '" + path + "': " + strerror(errno));
+    }
+
+    struct stat info;
+    bool fresh = fstat(fd, &info) == 0 && info.st_size == 0;
+
+    if (!fresh && static_cast<size_t>(info.st_size) != sizeof(File)) {
+        close(fd);
+        throw std::runtime_error("Not a state file '" + path + "'");
+    }
+
+    // allocate every block, a store into a sparse hole of the mapping raises SIGBUS on a full disk. Also sizes a
+    // fresh file and fills in one an earlier build left sparse.
+    int error = posix_fallocate(fd, 0, sizeof(File));
+    if (error != 0) {
+        close(fd);
+        throw std::runtime_error("Cannot allocate state file '" + path + "': " + strerror(error));
+    }
+
+    void *memory = mmap(nullptr, sizeof(File), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (memory == MAP_FAILED) {
+        throw std::runtime_error("Cannot map state file '" + path + "': " + strerror(errno));
+    }
+
+    File *file = static_cast<File *>(memory);
+
+    if (fresh) {
+        memcpy(file->magic, Magic, sizeof(Magic));
+        file->version = Version;
+    } else if (memcmp(file->magic, Magic, sizeof(Magic)) != 0 || file->version != Version) {
+        munmap(memory, sizeof(File));
+        throw std::runtime_error("Not a state file '" + path + "'");
+    }
+
+    if (m_File) {
+        munmap(m_File, sizeof(File));
+    }
+    m_File = file;
+
+    const Slot *slot = newest();
+    m_Sequence = slot ? slot->sequence : 0;
+    m_Last.clear();
+}
+
+uint32_t PersistentState::checksum(uint64_t sequence, uint32_t rigCount, const Rig *rigs) {
+    uint32_t hash = fnv(&sequence, sizeof(sequence));
+    hash = fnv(&rigCount, sizeof(rigCount), hash);
+    return fnv(rigs, sizeof(Rig) * std::min<size_t>(rigCount, MaxRigs), hash);
+}
+
+const PersistentState::Slot *PersistentState::newest() const {
+    const Slot *best = nullptr;
+
+    for (const Slot &slot : m_File->slots) {
+        bool intact = slot.sequence != 0 && slot.rigCount <= MaxRigs &&
+                      slot.checksum == checksum(slot.sequence, slot.rigCount, slot.rigs);
+
+        if (intact && (!best || slot.sequence > best->sequence)) {
+            best = &slot;
+        }
+    }
+    return best;
+}
+
+std::vector<PersistentState::Rig> PersistentState::load() const {
+    const Slot *slot = m_File ? newest() : nullptr;
+
+    if (!slot) {
+        return std::vector<Rig>();
+    }
+    return std::vector<Rig>(slot->rigs, slot->rigs + slot->rigCount);
+}
+
+void PersistentState::store(const std::vector<Rig> &rigs) {
+    size_t count = std::min(rigs.size(), MaxRigs);
+
+    if (!m_File || (m_Last.size() == count && memcmp(m_Last.data(), rigs.data(), count * sizeof(Rig)) == 0)) {
+        return;
+    }
+
+    // the slot of the older snapshot, the newer one stays intact until this one is complete
+    Slot &slot = m_File->slots[(m_Sequence + 1) & 1];
+    slot.sequence = 0;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+
+    slot.rigCount = static_cast<uint32_t>(count);
+    memcpy(slot.rigs, rigs.data(), count * sizeof(Rig));
+    slot.checksum = checksum(m_Sequence + 1, slot.rigCount, slot.rigs);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    slot.sequence = m_Sequence + 1;
+
+    m_Sequence++;
+    m_Last.assign(rigs.begin(), rigs.begin() + count);
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Axis positions, lens values and calibration of all heads in a small memory-mapped file, so a restarted process
+/// resumes where the last one stopped instead of assuming position zero.
+///
+/// File layout:
+///   bytes 0..3    "RSST"
+///   byte  4       version, 1
+///   bytes 5..63   reserved, 0
+///   two slots of 16 + 40 * MaxRigs bytes:
+///     u64 sequence, u32 checksum, u32 rig count, Rig records
+///
+/// The single writer fills the slot that does not hold the newest snapshot, then bumps its sequence, and never
+/// waits for anything. Every store lands in the page cache right away, so a crashed process loses nothing. The
+/// checksum covers sequence, rig count and records: a torn slot, e.g. after a power loss, fails it and the other
+/// slot is used.
+class PersistentState {
+public:
+    static constexpr size_t MaxRigs = 16;
+
+    /// What one head needs to resume.
+    struct Rig {
+        int32_t pitchPosition;
+        int32_t yawPosition;
+        int32_t pitchMin;       ///< Soft limits, valid if the flag is set.
+        int32_t pitchMax;
+        int32_t yawMin;
+        int32_t yawMax;
+        int32_t focus;
+        int32_t zoom;
+        uint32_t wiring;        ///< Hash of the rig config, a rewired head does not take over the state of another.
+        uint8_t flags;          ///< Flag bits.
+        uint8_t pitchPhase;     ///< Coil phase the rotors rest at, the first step after a restart goes on from it.
+        uint8_t yawPhase;
+        uint8_t reserved;
+    };
+
+    enum Flag {
+        IrCut = 1,
+        Homed = 2,
+        PitchLimited = 4,
+        YawLimited = 8
+    };
+
+    PersistentState();
+
+    ~PersistentState();
+
+    PersistentState(const PersistentState &) = delete;
+    PersistentState &operator=(const PersistentState &) = delete;
+
+    /// Map path, creating it if needed. Throws std::runtime_error if it cannot be allocated or mapped, or is not a
+    /// state file.
+    void open(const std::string &path);
+
+    bool isOpen() const {
+        return m_File != nullptr;
+    }
+
+    /// Records of the newest intact snapshot, empty if there is none.
+    std::vector<Rig> load() const;
+
+    /// Write a snapshot of up to MaxRigs heads, skipped if nothing changed. Only one thread may store.
+    void store(const std::vector<Rig> &rigs);
+
+private:
+    struct Slot {
+        uint64_t sequence;
+        uint32_t checksum;
+        uint32_t rigCount;
+        Rig rigs[MaxRigs];
+    };
+
+    struct File {
+        char magic[4];
+        char version;
+        char reserved[59];
+        Slot slots[2];
+    };
+
+    static uint32_t checksum(uint64_t sequence, uint32_t rigCount, const Rig *rigs);
+
+    /// Slot with the newest intact snapshot, nullptr if neither is.
+    const Slot *newest() const;
+
+    File *m_File;
+    uint64_t m_Sequence;
+    std::vector<Rig> m_Last;
+};
@@ -0,0 +1,220 @@
+#include "PresetStore.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace {
+
+const char Magic[4] = {'R', 'S', 'P', 'S'};
+const char Version = 1;
+const size_t HeaderSize = 8;
+
+void writeVarint(std::string &out, int value) {
+    // zigzag so small negative positions stay one or two bytes
+    uint32_t raw = (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+
+    while (raw >= 0x80) {
+        out += static_cast<char>((raw & 0x7F) | 0x80);
+        raw >>= 7;
+    }
+    out += static_cast<char>(raw);
+}
+
+bool readVarint(const std::string &in, size_t &offset, int &value) {
+    uint32_t raw = 0;
+
+    for (unsigned shift = 0; shift < 35 && offset < in.size(); shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(in[offset++]);
+        raw |= static_cast<uint32_t>(byte & 0x7F) << shift;
+
+        if (!(byte & 0x80)) {
+            value = static_cast<int>((raw >> 1) ^ (~(raw & 1) + 1));
+            return true;
+        }
+    }
+
+    return false;
+}
+
+}
+
+void PresetStore::open(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    std::map<Key, Preset> presets;
+
+    if (file) {
+        std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        if (data.size() < HeaderSize || memcmp(data.data(), Magic, sizeof(Magic)) != 0 || data[4] != Version) {
+            throw std::runtime_error("Not a preset store '" + path + "'");
+        }
+
+        size_t offset = HeaderSize;
+
+        while (offset < data.size()) {
+            if (data.size() - offset < 2) {
+                throw std::runtime_error("Truncated preset store '" + path + "'");
+            }
+
+            unsigned rig = static_cast<uint8_t>(data[offset]);
+            size_t length = static_cast<uint8_t>(data[offset + 1]);
+            offset += 2;
+
+            if (data.size() - offset < length) {
+                throw std::runtime_error("Truncated preset store '" + path + "'");
+            }
+
+            std::string name = data.substr(offset, length);
+            offset += length;
+
+            Preset preset;
+
+            if (!readVarint(data, offset, preset.pitchPosition) || !readVarint(data, offset, preset.yawPosition) ||
+                !readVarint(data, offset, preset.focus) || !readVarint(data, offset, preset.zoom) ||
+                offset >= data.size()) {
+                throw std::runtime_error("Truncated preset store '" + path + "'");
+            }
+
+            preset.irCut = data[offset++] != 0;
+            presets[Key(rig, name)] = preset;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_Presets.swap(presets);
+    m_Path = path;
+}
+
+bool PresetStore::isValidName(const std::string &name) {
+    if (name.empty() || name.size() > MaxName) {
+        return false;
+    }
+
+    for (char c : name) {
+        bool valid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' ||
+                     c == '-';
+        if (!valid) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void PresetStore::set(unsigned rig, const std::string &name, const Preset &preset) {
+    if (!isValidName(name)) {
+        throw std::invalid_argument("invalid preset name '" + name + "'");
+    }
+
+    if (rig > 0xFF) {
+        throw std::invalid_argument("rig " + std::to_string(rig) + " cannot store presets");
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_Presets[Key(rig, name)] = preset;
+    save();
+}
+
+bool PresetStore::get(unsigned rig, const std::string &name, Preset &preset) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_Presets.find(Key(rig, name));
+
+    if (it == m_Presets.end()) {
+        return false;
+    }
+
+    preset = it->second;
+    return true;
+}
+
+bool PresetStore::remove(unsigned rig, const std::string &name) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_Presets.erase(Key(rig, name)) == 0) {
+        return false;
+    }
+
+    save();
+    return true;
+}
+
+std::vector<std::string> PresetStore::names(unsigned rig) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<std::string> names;
+
+    for (auto it = m_Presets.lower_bound(Key(rig, std::string())); it != m_Presets.end() && it->first.first == rig;
+         ++it) {
+        names.push_back(it->first.second);
+    }
+    return names;
+}
+
+void PresetStore::save() const {
+    if (m_Path.empty()) {
+        return;
+    }
+
+    std::string data(Magic, sizeof(Magic));
+    data += Version;
+    data.append(HeaderSize - data.size(), '\0');
+
+    for (auto &entry : m_Presets) {
+        data += static_cast<char>(entry.first.first);
+        data += static_cast<char>(entry.first.second.size());
+        data += entry.first.second;
+        writeVarint(data, entry.second.pitchPosition);
+        writeVarint(data, entry.second.yawPosition);
+        writeVarint(data, entry.second.focus);
+        writeVarint(data, entry.second.zoom);
+        data += static_cast<char>(entry.second.irCut ? 1 : 0);
+    }
+
+    const std::string temporary = m_Path + ".tmp";
+
+    // the data has to be on the disk before the rename is, or a crash can leave an empty file under the old name
+    int file = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (file < 0) {
+        throw std::runtime_error("Cannot write preset store '" + temporary + "': " + strerror(errno));
+    }
+
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t result = ::write(file, data.data() + written, data.size() - written);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            break;
+        }
+        written += static_cast<size_t>(result);
+    }
+
+    if (written < data.size() || fsync(file) != 0) {
+        std::string error = strerror(errno);
+        close(file);
+        throw std::runtime_error("Cannot write preset store '" + temporary + "': " + error);
+    }
+    close(file);
+
+    if (rename(temporary.c_str(), m_Path.c_str()) != 0) {
+        throw std::runtime_error("Cannot replace preset store '" + m_Path + "': " + strerror(errno));
+    }
+
+    // and the rename has to be on the disk before the change is acknowledged
+    size_t slash = m_Path.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : m_Path.substr(0, slash));
+    int dir = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir < 0 || fsync(dir) != 0) {
+        std::string error = strerror(errno);
+        if (dir >= 0) {
+            close(dir);
+        }
+        throw std::runtime_error("Cannot sync preset store directory '" + directory + "': " + error);
+    }
+    close(dir);
+}
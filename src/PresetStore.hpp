@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// Stored shot of one head.
+struct Preset {
+    int pitchPosition;  ///< Half steps since power-on.
+    int yawPosition;    ///< Half steps since power-on.
+    int focus;
+    int zoom;
+    bool irCut;
+};
+
+/// Named presets of all heads, kept in memory and written through to a small binary file.
+///
+/// File layout:
+///   bytes 0..3  "RSPS"
+///   byte  4     version, 1
+///   bytes 5..7  reserved, 0
+///   records until the end of the file:
+///     u8 rig, u8 name length, name bytes,
+///     zigzag varints pitch, yaw, focus, zoom (LEB128), u8 ir cut
+///
+/// Every change rewrites the file next to it and renames it over the old one, so a crash never leaves a torn store.
+class PresetStore {
+public:
+    /// Longest accepted preset name.
+    static constexpr size_t MaxName = 32;
+
+    /// Memory only store until open() is called.
+    PresetStore() = default;
+
+    /// Load the presets from path and write every later change back to it. A missing file is an empty store.
+    /// Throws std::runtime_error if the file exists but is not a preset store.
+    void open(const std::string &path);
+
+    /// True for 1 to MaxName letters, digits, '_' or '-'.
+    static bool isValidName(const std::string &name);
+
+    /// Add or replace a preset. Throws std::invalid_argument for a bad name, std::runtime_error if it cannot be saved.
+    void set(unsigned rig, const std::string &name, const Preset &preset);
+
+    /// @return False if there is no such preset.
+    bool get(unsigned rig, const std::string &name, Preset &preset) const;
+
+    /// @return False if there was no such preset.
+    bool remove(unsigned rig, const std::string &name);
+
+    /// Names of the presets of a rig in alphabetical order.
+    std::vector<std::string> names(unsigned rig) const;
+
+private:
+    typedef std::pair<unsigned, std::string> Key;
+
+    /// Write all presets to m_Path. Called with m_mutex held.
+    void save() const;
+
+    mutable std::mutex m_mutex;
+    std::map<Key, Preset> m_Presets;
+    /// Empty while memory only.
+    std::string m_Path;
+};
@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+#include "ResponseCurve.hpp"
+
+const int ResponseCurve::MaxVector;
+const uint32_t ResponseCurve::MaxInterval;
+
+ResponseCurve::Shape ResponseCurve::linear()
+{
+    Shape shape;
+    shape.deadband = 0.0;
+    shape.gamma = 1.0;
+    shape.maxRate = 200.0;
+    return shape;
+}
+
+void ResponseCurve::validate(const Shape& shape, const std::vector<Band>& bands)
+{
+    if(!(shape.deadband >= 0.0 && shape.deadband < 1.0))
+        throw std::invalid_argument("Response deadband must be at least 0 and below 1");
+    if(!(shape.gamma > 0.0))
+        throw std::invalid_argument("Response gamma must be positive");
+    if(!(shape.maxRate > 0.0))
+        throw std::invalid_argument("Response max rate must be positive");
+
+    const double minRate = 1e6 / MaxInterval;
+    for(const Band& band : merge(bands))
+    {
+        if(band.low < minRate && band.high > shape.maxRate)
+            throw std::invalid_argument("Resonance bands leave the axis no rate to run at");
+    }
+}
+
+std::vector<ResponseCurve::Band> ResponseCurve::merge(std::vector<Band> bands)
+{
+    std::vector<Band> merged;
+
+    std::sort(bands.begin(), bands.end(), [](const Band& a, const Band& b) { return a.low < b.low; });
+    for(const Band& band : bands)
+    {
+        if(!(band.low >= 0.0 && band.high > band.low))
+            throw std::invalid_argument("Resonance band must run from a rate of at least 0 up to a higher one");
+
+        // touching bands merge too, a single safe rate between them would be no use. So do bands without a whole
+        // interval between them, rounding a rate out of one to its edge would land it inside the other.
+        if(!merged.empty() && (band.low <= merged.back().high ||
+                               std::ceil(1e6 / band.low) > std::floor(1e6 / merged.back().high)))
+            merged.back().high = std::max(merged.back().high, band.high);
+        else
+            merged.push_back(band);
+    }
+    return merged;
+}
+
+ResponseCurve::ResponseCurve(const Shape& shape, std::vector<Band> bands)
+    : m_Shape(shape)
+{
+    validate(shape, bands);
+    m_Bands = merge(std::move(bands));
+
+    for(int vector = -MaxVector; vector <= MaxVector; vector++)
+    {
+        double deflection = std::abs(vector) / static_cast<double>(MaxVector);
+        uint32_t interval = 0;
+
+        if(vector != 0 && deflection > shape.deadband)
+        {
+            double rate = shape.maxRate * std::pow((deflection - shape.deadband) / (1.0 - shape.deadband), shape.gamma);
+            // a gamma curve creeps towards zero just past the deadband, hold the slowest rate the axis always had
+            double micros = rate > 0.0 ? std::min(1e6 / rate, static_cast<double>(MaxInterval)) : MaxInterval;
+            interval = avoidBands(static_cast<uint32_t>(std::max(1L, std::lround(micros))));
+        }
+
+        m_Intervals[vector + MaxVector] = interval;
+    }
+}
+
+uint32_t ResponseCurve::avoidBands(uint32_t interval) const
+{
+    const double minRate = 1e6 / MaxInterval;
+    double rate = 1e6 / interval;
+
+    for(const Band& band : m_Bands)
+    {
+        if(rate <= band.low || rate >= band.high)
+            continue;
+
+        // round each edge outwards, so the integer interval does not land a hair inside the band. merge() left a
+        // whole interval between neighbouring bands, the rounded edge never lands in the next one.
+        bool slower = band.low >= minRate;
+        bool faster = band.high <= m_Shape.maxRate;
+        if(slower && (!faster || rate - band.low <= band.high - rate))
+            return static_cast<uint32_t>(std::min(std::ceil(1e6 / band.low), static_cast<double>(MaxInterval)));
+        return static_cast<uint32_t>(std::max(1.0, std::floor(1e6 / band.high)));
+    }
+    return interval;
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Speed response of one stepper axis to a velocity vector [-100,100]. The shape is compiled into a table of
+// half step intervals once at config time, so a velocity command costs one lookup and the engine never divides.
+//
+// The stick travel past the deadband is rescaled to [0,1] and raised to gamma, a gamma above 1 leaves more travel
+// for slow, fine moves and still reaches the full rate at the end stop of the stick.
+//
+// Resonance bands are step rates at which the mechanics vibrate, lose torque and stall. No entry of the table
+// falls inside one, a rate that would is moved to the nearer edge of the band. The engine changes the interval
+// from one step to the next, so an axis speeding up or slowing down crosses a band without spending a step in it.
+class ResponseCurve
+{
+public:
+    struct Shape
+    {
+        double deadband;    // share of the stick travel around the centre that stands still, [0,1)
+        double gamma;       // exponent of the response, 1 is linear
+        double maxRate;     // half steps per second at full deflection
+    };
+
+    // Step rates in half steps per second an axis must not cruise at, the edges themselves are safe
+    struct Band
+    {
+        double low;
+        double high;
+    };
+
+    static const int MaxVector = 100;
+
+    // Slowest interval any entry gets, the rate of vector 1 on the linear curve
+    static const uint32_t MaxInterval = 500000;
+
+    // The response the axes always had: no deadband, linear, 5 ms per half step at full speed
+    static Shape linear();
+
+    // Throws std::invalid_argument for a deadband outside [0,1), a gamma or max rate that is not positive, or a band
+    // that is empty or spans every rate from the slowest interval to the max rate. Overlapping bands are merged.
+    explicit ResponseCurve(const Shape& shape = linear(), std::vector<Band> bands = std::vector<Band>());
+
+    // Throw what the constructor would for shape and bands, without compiling a table
+    static void validate(const Shape& shape, const std::vector<Band>& bands = std::vector<Band>());
+
+    // Microseconds between two half steps at vector, 0 inside the deadband. Vectors beyond +-MaxVector clamp.
+    uint32_t interval(int vector) const
+    {
+        int index = vector < -MaxVector ? 0 : (vector > MaxVector ? 2 * MaxVector : vector + MaxVector);
+        return m_Intervals[index];
+    }
+
+    const Shape& getShape() const
+    {
+        return m_Shape;
+    }
+
+    // Merged bands in ascending order, neighbours leave at least one whole interval between them
+    const std::vector<Band>& getBands() const
+    {
+        return m_Bands;
+    }
+private:
+    // Sorted bands with overlapping and touching ones joined, as are ones with no whole interval between them.
+    // Throws std::invalid_argument for an empty band.
+    static std::vector<Band> merge(std::vector<Band> bands);
+
+    // Interval of the rate nearest to the one of interval that lies in no band
+    uint32_t avoidBands(uint32_t interval) const;
+
+    Shape m_Shape;
+    std::vector<Band> m_Bands;
+    std::array<uint32_t, 2 * MaxVector + 1> m_Intervals;
+};
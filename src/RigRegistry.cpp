@@ -0,0 +1,232 @@
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include "RigRegistry.hpp"
+#include "Gpio.hpp"
+#include "Logger.hpp"
+#include "StepEngine.hpp"
+
+namespace
+{
+
+// comma separated list of exactly N unsigned numbers
+template <size_t N>
+std::array<unsigned, N> parseList(const std::string& list, const std::string& spec)
+{
+    std::array<unsigned, N> values;
+    std::istringstream in(list);
+    std::string value;
+    size_t count = 0;
+
+    while(std::getline(in, value, ','))
+    {
+        if(count == values.size())
+        {
+            throw std::invalid_argument("rig '" + spec + "' needs exactly " + std::to_string(N) + " values in '" + list + "'");
+        }
+
+        try
+        {
+            size_t used;
+            values[count++] = std::stoul(value, &used);
+            if(used != value.size())
+            {
+                throw std::invalid_argument(value);
+            }
+        }
+        catch(const std::exception&)
+        {
+            throw std::invalid_argument("rig '" + spec + "' has invalid value '" + value + "'");
+        }
+    }
+
+    if(count != values.size())
+    {
+        throw std::invalid_argument("rig '" + spec + "' needs exactly " + std::to_string(N) + " values in '" + list + "'");
+    }
+    return values;
+}
+
+}
+
+RigConfig RigRegistry::defaultRig()
+{
+    RigConfig config;
+    config.pitchPins = {7, 0, 2, 3};
+    config.yawPins = {22, 23, 24, 25};
+    config.lensAddress = 0x0C;
+    config.pitchEndStops = {-1, -1};
+    config.yawEndStops = {-1, -1};
+    config.backlash = {0, 0};
+    config.response = {ResponseCurve::linear(), ResponseCurve::linear()};
+    config.tracking = Tracker::defaults();
+    return config;
+}
+
+RigConfig RigRegistry::parseRig(const std::string& spec)
+{
+    std::istringstream in(spec);
+    std::string pitch, yaw, lens, endStops, backlash;
+
+    if(!std::getline(in, pitch, ':') || !std::getline(in, yaw, ':'))
+    {
+        throw std::invalid_argument("rig '" + spec + "' must look like P1,P2,P3,P4:Y1,Y2,Y3,Y4[:LENS[:PMIN,PMAX,YMIN,YMAX[:PB,YB]]]");
+    }
+
+    RigConfig config;
+    config.pitchPins = parseList<4>(pitch, spec);
+    config.yawPins = parseList<4>(yaw, spec);
+    config.lensAddress = 0x0C;
+    config.pitchEndStops = {-1, -1};
+    config.yawEndStops = {-1, -1};
+    config.backlash = {0, 0};
+    config.response = {ResponseCurve::linear(), ResponseCurve::linear()};
+    config.tracking = Tracker::defaults();
+
+    // optional fields may be left empty to reach the ones after them
+    if(std::getline(in, lens, ':') && !lens.empty())
+    {
+        try
+        {
+            size_t used;
+            config.lensAddress = std::stoi(lens, &used, 0);
+            if(used != lens.size())
+            {
+                throw std::invalid_argument(lens);
+            }
+        }
+        catch(const std::exception&)
+        {
+            throw std::invalid_argument("rig '" + spec + "' has invalid lens address '" + lens + "'");
+        }
+    }
+
+    if(std::getline(in, endStops, ':') && !endStops.empty())
+    {
+        auto pins = parseList<4>(endStops, spec);
+        config.pitchEndStops = {static_cast<int>(pins[0]), static_cast<int>(pins[1])};
+        config.yawEndStops = {static_cast<int>(pins[2]), static_cast<int>(pins[3])};
+    }
+
+    if(std::getline(in, backlash, ':') && !backlash.empty())
+    {
+        config.backlash = parseList<2>(backlash, spec);
+    }
+    return config;
+}
+
+RigRegistry::RigRegistry(const std::vector<RigConfig>& rigs, std::shared_ptr<Clock> clock)
+{
+    if(rigs.empty())
+    {
+        throw std::invalid_argument("no rig configured");
+    }
+
+    std::set<unsigned> pins;
+    std::set<int> lenses;
+
+    for(auto& rig : rigs)
+    {
+        for(auto& axis : {rig.pitchPins, rig.yawPins})
+        {
+            for(unsigned pin : axis)
+            {
+                if(!pins.insert(pin).second)
+                {
+                    throw std::invalid_argument("pin " + std::to_string(pin) + " is used by more than one axis");
+                }
+            }
+        }
+
+        for(auto& axis : {rig.pitchEndStops, rig.yawEndStops})
+        {
+            for(int pin : axis)
+            {
+                if(pin >= 0 && !pins.insert(static_cast<unsigned>(pin)).second)
+                {
+                    throw std::invalid_argument("end-stop pin " + std::to_string(pin) + " is already in use");
+                }
+            }
+        }
+
+        if(!lenses.insert(rig.lensAddress).second)
+        {
+            throw std::invalid_argument("lens address " + std::to_string(rig.lensAddress) + " is used by more than one rig");
+        }
+    }
+
+    wiringPiSetup();
+
+    m_Engine.reset(new StepEngine(std::move(clock)));
+
+    for(auto& rig : rigs)
+    {
+        m_Rigs.emplace_back(new MotorController(rig, *m_Engine, m_Presets, static_cast<unsigned>(m_Rigs.size())));
+    }
+}
+
+RigRegistry::~RigRegistry()
+{
+    // the last pass has persisted the final positions
+    m_Engine->setOnPass(nullptr);
+    // heads first, they detach their steppers from the engine
+    m_Rigs.clear();
+}
+
+void RigRegistry::openState(const std::string& path)
+{
+    // the heads past the limit would silently start at zero after every restart
+    if(m_Rigs.size() > PersistentState::MaxRigs)
+        throw std::runtime_error("The state file holds at most " + std::to_string(PersistentState::MaxRigs) +
+                                 " rigs, " + std::to_string(m_Rigs.size()) + " are configured; pass an empty " +
+                                 "--state-file or run the others in another process");
+
+    m_State.open(path);
+
+    std::vector<PersistentState::Rig> saved = m_State.load();
+    for(size_t id = 0; id < m_Rigs.size() && id < saved.size(); id++)
+    {
+        if(m_Rigs[id]->restore(saved[id]))
+        {
+            Logger::info("Rig %zu resumed at pitch %d yaw %d", id, saved[id].pitchPosition, saved[id].yawPosition);
+        }
+        else
+        {
+            Logger::warning("Rig %zu is wired differently than the saved one, starting at zero", id);
+        }
+    }
+
+    std::vector<PersistentState::Rig> snapshot(m_Rigs.size());
+    m_Engine->setOnPass([this, snapshot]() mutable
+    {
+        for(size_t id = 0; id < m_Rigs.size(); id++)
+        {
+            snapshot[id] = m_Rigs[id]->getPersisted();
+        }
+        m_State.store(snapshot);
+    });
+}
+
+void RigRegistry::stop()
+{
+    for(auto& rig : m_Rigs)
+    {
+        rig->stop();
+    }
+}
+
+void RigRegistry::cancelHoming()
+{
+    for(auto& rig : m_Rigs)
+    {
+        rig->cancelHoming();
+    }
+}
+
+void RigRegistry::stopJogging()
+{
+    for(auto& rig : m_Rigs)
+    {
+        rig->stopJogging();
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "Clock.hpp"
+#include "MotorController.hpp"
+#include "PersistentState.hpp"
+#include "PresetStore.hpp"
+
+class StepEngine;
+
+// All pan/tilt heads driven by this process, addressed by id in the order they were configured.
+// Every head has its own pins and lens driver, all steppers share one StepEngine.
+class RigRegistry
+{
+public:
+    // Wiring of the original single head: pitch 7,0,2,3, yaw 22,23,24,25, lens 0x0C, no end-stops, no backlash compensation
+    static RigConfig defaultRig();
+
+    // Parse "P1,P2,P3,P4:Y1,Y2,Y3,Y4[:LENS[:PMIN,PMAX,YMIN,YMAX[:PB,YB]]]", pins in wiringPi numbering, the lens
+    // address in decimal or 0x hex and 0x0C if omitted, the end-stop pins are optional and needed for homing,
+    // PB and YB the measured gear backlash of pitch and yaw in half steps. Optional fields may be left empty.
+    // Throws std::invalid_argument on bad input.
+    static RigConfig parseRig(const std::string& spec);
+
+    // Throws std::invalid_argument if no rig is given or two axes or end-stops share a pin or two rigs a lens address.
+    // All motion and lens timing runs on the given clock.
+    explicit RigRegistry(const std::vector<RigConfig>& rigs, std::shared_ptr<Clock> clock = Clock::system());
+    ~RigRegistry();
+
+    size_t size() const
+    {
+        return m_Rigs.size();
+    }
+
+    // Head with the given id, nullptr if there is none
+    MotorController* get(unsigned id) const
+    {
+        return id < m_Rigs.size() ? m_Rigs[id].get() : nullptr;
+    }
+
+    // Stop the stepper axes of every head
+    void stop();
+
+    // Stop the axes of every head that are jogged by velocity, preset moves run to the end
+    void stopJogging();
+
+    // Fail the homing of every head, see MotorController::cancelHoming()
+    void cancelHoming();
+
+    // Presets of all heads, memory only until opened
+    PresetStore& getPresets()
+    {
+        return m_Presets;
+    }
+
+    // Resume every head from the state file at path, then keep it up to date from the step engine.
+    // Throws std::runtime_error if it cannot be mapped or there are more heads than PersistentState::MaxRigs.
+    // Call before the heads take commands.
+    void openState(const std::string& path);
+
+    StepEngine& getStepEngine()
+    {
+        return *m_Engine;
+    }
+private:
+    // declared first so they outlive the heads that use them
+    std::unique_ptr<StepEngine> m_Engine;
+    PresetStore m_Presets;
+    // written by the engine thread only
+    PersistentState m_State;
+    std::vector<std::unique_ptr<MotorController>> m_Rigs;
+};
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// What a full SendQueue does with one more message.
+enum class DropPolicy {
+    DropOldest, ///< Discard the oldest queued message.
+    DropNewest, ///< Discard the message being pushed.
+    Coalesce    ///< Replace the queued message with the same key, otherwise discard the oldest.
+};
+
+/// Parse "drop-oldest", "drop-newest" or "coalesce".
+inline DropPolicy parseDropPolicy(const std::string &name) {
+    if (name == "drop-oldest") {
+        return DropPolicy::DropOldest;
+    }
+    if (name == "drop-newest") {
+        return DropPolicy::DropNewest;
+    }
+    if (name == "coalesce") {
+        return DropPolicy::Coalesce;
+    }
+    throw std::invalid_argument("unknown drop policy '" + name + "'");
+}
+
+/// Messages pushed without a key are never coalesced.
+constexpr int NoSendKey = -1;
+
+/// Fixed capacity FIFO ring for the outgoing messages of one connection.
+/// All slots are allocated up front, so a slow peer costs at most capacity messages of memory.
+/// Not synchronized, the owner locks around it. Depth and drop counters can be read from any thread.
+template <typename T>
+class SendQueue {
+public:
+    explicit SendQueue(size_t capacity = 64, DropPolicy policy = DropPolicy::DropOldest)
+            : m_Slots(capacity > 0 ? capacity : 1), m_Head(0), m_Size(0), m_Policy(policy), m_Depth(0),
+              m_Dropped(0) {
+    }
+
+    /// Queue a message, applying the drop policy when full.
+    /// @return False if a message had to be dropped.
+    bool push(T item, int key = NoSendKey) {
+        if (m_Policy == DropPolicy::Coalesce && key != NoSendKey) {
+            for (size_t i = 0; i < m_Size; i++) {
+                Slot &slot = m_Slots[(m_Head + i) % m_Slots.size()];
+
+                if (slot.key == key) {
+                    // the newer message supersedes the queued one and keeps its place in line
+                    slot.item = std::move(item);
+                    m_Dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+            }
+        }
+
+        bool dropped = false;
+
+        if (m_Size == m_Slots.size()) {
+            m_Dropped.fetch_add(1, std::memory_order_relaxed);
+            dropped = true;
+
+            if (m_Policy == DropPolicy::DropNewest) {
+                return false;
+            }
+
+            T oldest;
+            pop(oldest);
+        }
+
+        Slot &slot = m_Slots[(m_Head + m_Size) % m_Slots.size()];
+        slot.item = std::move(item);
+        slot.key = key;
+        m_Size++;
+        m_Depth.store(m_Size, std::memory_order_relaxed);
+
+        return !dropped;
+    }
+
+    /// Take the oldest message.
+    /// @return False if the queue is empty.
+    bool pop(T &item) {
+        if (m_Size == 0) {
+            return false;
+        }
+
+        Slot &slot = m_Slots[m_Head];
+        item = std::move(slot.item);
+        // release references early, e.g. pooled buffers waiting for reuse
+        slot.item = T();
+        slot.key = NoSendKey;
+
+        m_Head = (m_Head + 1) % m_Slots.size();
+        m_Size--;
+        m_Depth.store(m_Size, std::memory_order_relaxed);
+
+        return true;
+    }
+
+    /// Drop everything and change capacity and policy. Allocates, call at setup time.
+    void configure(size_t capacity, DropPolicy policy) {
+        clear();
+        m_Slots.assign(capacity > 0 ? capacity : 1, Slot());
+        m_Head = 0;
+        m_Policy = policy;
+    }
+
+    void clear() {
+        T item;
+        while (pop(item)) {
+        }
+    }
+
+    bool empty() const {
+        return m_Size == 0;
+    }
+
+    size_t capacity() const {
+        return m_Slots.size();
+    }
+
+    /// Queued messages, readable from any thread.
+    size_t getDepth() const {
+        return m_Depth.load(std::memory_order_relaxed);
+    }
+
+    /// Messages discarded or superseded so far, readable from any thread.
+    uint64_t getDropped() const {
+        return m_Dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Slot {
+        T item;
+        int key = NoSendKey;
+    };
+
+    std::vector<Slot> m_Slots;
+    size_t m_Head;
+    size_t m_Size;
+    DropPolicy m_Policy;
+
+    std::atomic<size_t> m_Depth;
+    std::atomic<uint64_t> m_Dropped;
+};
+
+/// Depth and drop counters of one endpoint's send queues.
+struct SendQueueStats {
+    size_t depth = 0;
+    uint64_t dropped = 0;
+};
@@ -1,8 +1,21 @@
 #include "Server.hpp"
 
-WebSocketServer::WebSocketServer(uint16_t port) : m_Running(false) {
+#include "LatencyMonitor.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+
+WebSocketServer::WebSocketServer(uint16_t port)
+        : m_Running(false), m_Work(64, DropPolicy::Coalesce), m_QueueCapacity(64),
+          m_QueuePolicy(DropPolicy::Coalesce), m_HighWater(64 * 1024) {
     m_Server = std::make_shared<Server>();
 
+    m_ConnectionList = std::make_shared<const ConnectionList>();
+
+    // server frames are not masked, so one framed copy is valid for every connection
+    m_MessageManager = std::make_shared<websocketpp::config::asio::con_msg_manager_type>();
+    m_FrameProcessor.reset(new FrameProcessor(false, true, m_MessageManager, m_Rng));
+
     m_Server->set_access_channels(websocketpp::log::alevel::none);
     m_Server->set_error_channels(websocketpp::log::elevel::none);
 
@@ -11,6 +24,7 @@ WebSocketServer::WebSocketServer(uint16_t port) : m_Running(false) {
     m_Server->set_close_handler(bind(&WebSocketServer::onClose, this, std::placeholders::_1));
     m_Server->set_message_handler(
             bind(&WebSocketServer::onMessageReceived, this, std::placeholders::_1, std::placeholders::_2));
+    m_Server->set_http_handler(bind(&WebSocketServer::onHttp, this, std::placeholders::_1));
 
     try {
         m_Server->set_reuse_addr(true);
@@ -21,6 +35,8 @@ WebSocketServer::WebSocketServer(uint16_t port) : m_Running(false) {
         m_Server->start_accept();
 
         m_AsioThread = std::thread([=]() {
+            Trace::setThreadName("server io");
+
             try {
                 m_Server->run();
             }
@@ -30,45 +46,96 @@ WebSocketServer::WebSocketServer(uint16_t port) : m_Running(false) {
         });
     }
     catch (std::exception &ex) {
-        std::cerr << "Failed to open server, error = " << ex.what() << std::endl;
+        Logger::error("Failed to open server, error = '%s'.", ex.what());
     }
 
     m_Running = true;
     m_WorkerThread = std::thread([=]() {
+        bool congested = false;
+        std::vector<Outgoing> pending;
+
         while (m_Running) {
-            std::shared_ptr<const std::string> message;
-            websocketpp::connection_hdl hdl;
+            size_t highWater;
 
+            // take the queued work and leave, framing and sending must not hold up send() on other threads
             {
                 std::unique_lock<std::mutex> lock(m_mutex);
 
-                m_not_empty.wait(lock, std::bind(&WebSocketServer::has_new_data, this));
+                // websocketpp does not tell when a socket drains, so poll while a peer is backed up
+                m_not_empty.wait_for(lock, std::chrono::milliseconds(congested ? 5 : 100),
+                                     std::bind(&WebSocketServer::has_new_data, this));
 
                 if (!m_Running) {
                     break;
                 }
 
-                auto work = m_Work[0];
-                message = work.first;
-                hdl = work.second;
-                m_Work.pop_front();
+                Outgoing work;
+
+                while (m_Work.pop(work)) {
+                    pending.push_back(std::move(work));
+                }
+                highWater = m_HighWater;
             }
 
-            if (hdl.lock()) {
+            auto connections = std::atomic_load(&m_ConnectionList);
+
+            for (auto &work : pending) {
+                if (connections->empty()) {
+                    continue;
+                }
+
+                Server::message_ptr prepared;
+
                 try {
-                    auto con = m_Server->get_con_from_hdl(hdl);
-                    m_Server->send(con, *message, websocketpp::frame::opcode::TEXT);
+                    prepared = prepareMessage(*work.message, work.opcode);
                 }
                 catch (std::exception &ex) {
-                    std::cerr << "Failed to send message, error = " << ex.what() << std::endl;
+                    Logger::error("Failed to prepare message, error = '%s'.", ex.what());
+                    continue;
                 }
-            } else {
-                for (auto it : m_ConnectionList) {
-                    try {
-                        m_Server->send(it, *message,websocketpp::frame::opcode::TEXT);
+
+                if (work.hdl.lock()) {
+                    auto it = connections->find(work.hdl);
+
+                    if (it != connections->end()) {
+                        it->second->queue.push(prepared, work.key);
                     }
-                    catch (std::exception &ex) {
-                        std::cerr << "Failed to send message, error = "<< ex.what() << std::endl;
+                } else {
+                    for (auto &it : *connections) {
+                        it.second->queue.push(prepared, work.key);
+                    }
+                }
+            }
+
+            pending.clear();
+            congested = false;
+
+            for (auto &it : *connections) {
+                auto &queue = it.second->queue;
+
+                websocketpp::lib::error_code ec;
+                auto con = m_Server->get_con_from_hdl(it.first, ec);
+
+                if (ec) {
+                    queue.clear();
+                    continue;
+                }
+
+                Server::message_ptr msg;
+
+                while (!queue.empty()) {
+                    // leave the rest to the drop policy until the peer catches up
+                    if (con->get_buffered_amount() > highWater) {
+                        congested = true;
+                        break;
+                    }
+
+                    queue.pop(msg);
+                    ec = con->send(msg);
+
+                    // closing connections reject sends, they leave the list with onClose
+                    if (ec && ec != websocketpp::error::invalid_state) {
+                        Logger::error("Failed to send message, error = '%s'.", ec.message().c_str());
                     }
                 }
             }
@@ -76,6 +143,61 @@ WebSocketServer::WebSocketServer(uint16_t port) : m_Running(false) {
     });
 }
 
+WebSocketServer::Server::message_ptr WebSocketServer::prepareMessage(const std::string &payload,
+                                                                    websocketpp::frame::opcode::value opcode) {
+    auto msg = m_MessageManager->get_message(opcode, payload.size());
+    msg->set_payload(payload);
+
+    auto framed = m_MessageManager->get_message();
+    auto ec = m_FrameProcessor->prepare_data_frame(msg, framed);
+
+    if (ec) {
+        throw websocketpp::exception(ec);
+    }
+
+    return framed;
+}
+
+void WebSocketServer::updateConnections(const std::function<void(ConnectionList &)> &change) {
+    std::lock_guard<std::mutex> lock(m_ConnectionMutex);
+
+    auto copy = std::make_shared<ConnectionList>(*std::atomic_load(&m_ConnectionList));
+    change(*copy);
+    std::atomic_store(&m_ConnectionList, ConnectionListPtr(std::move(copy)));
+}
+
+size_t WebSocketServer::getConnectionCount() const {
+    return std::atomic_load(&m_ConnectionList)->size();
+}
+
+void WebSocketServer::setSendQueue(size_t capacity, DropPolicy policy, size_t highWater) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_Work.configure(capacity, policy);
+    m_QueueCapacity = capacity;
+    m_QueuePolicy = policy;
+    m_HighWater = highWater;
+}
+
+SendQueueStats WebSocketServer::getSendQueueStats() const {
+    SendQueueStats stats;
+    stats.depth = m_Work.getDepth();
+    stats.dropped = m_Work.getDropped();
+
+    for (auto &it : *std::atomic_load(&m_ConnectionList)) {
+        stats.depth += it.second->queue.getDepth();
+        stats.dropped += it.second->queue.getDropped();
+    }
+
+    return stats;
+}
+
+void WebSocketServer::setMessageHandler(MessageHandler handler) {
+    m_Server->get_io_service().post([this, handler]() {
+        m_MessageHandler = handler;
+    });
+}
+
 void WebSocketServer::setMaxMessageSize(size_t newSize) {
     if (m_Server) {
         m_Server->set_max_message_size(newSize);
@@ -92,22 +214,24 @@ WebSocketServer::~WebSocketServer() {
 
     m_Server->stop_listening();
 
-    for (auto it : m_ConnectionList) {
+    for (auto &it : *std::atomic_load(&m_ConnectionList)) {
         try {
             websocketpp::lib::error_code ec;
-            m_Server->pause_reading(it);
-            m_Server->close(it, websocketpp::close::status::going_away, "", ec);
+            m_Server->pause_reading(it.first);
+            m_Server->close(it.first, websocketpp::close::status::going_away, "", ec);
 
             if (ec) {
-                std::cerr << "Failed to shutdown connection, error = '%s'."<< ec.message().c_str() << std::endl;
+                Logger::error("Failed to shutdown connection, error = '%s'.", ec.message().c_str());
             }
         }
         catch (std::exception &ex) {
-            std::cerr << "Failed to shutdown connection, error = '%s'."<< ex.what() << std::endl;
+            Logger::error("Failed to shutdown connection, error = '%s'.", ex.what());
         }
     }
 
-    m_ConnectionList.clear();
+    updateConnections([](ConnectionList &connections) {
+        connections.clear();
+    });
     m_Server.reset();
 
     if (m_AsioThread.joinable()) {
@@ -121,32 +245,44 @@ void WebSocketServer::send(const std::string &message, websocketpp::connection_h
     }
 }
 
-void WebSocketServer::send(std::shared_ptr<const std::string> message, websocketpp::connection_hdl hdl) {
+void WebSocketServer::send(std::shared_ptr<const std::string> message, websocketpp::connection_hdl hdl,
+                           websocketpp::frame::opcode::value opcode, int key) {
     if (message && !message->empty()) {
         std::unique_lock<std::mutex> lock(m_mutex);
-        m_Work.push_back(std::make_pair(message, hdl));
+        m_Work.push(Outgoing{std::move(message), hdl, opcode, key}, key);
         lock.unlock();
         m_not_empty.notify_one();
     }
 }
 
 void WebSocketServer::onOpen(websocketpp::connection_hdl hdl) {
-    m_ConnectionList.insert(hdl);
+    std::shared_ptr<Peer> peer;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        peer = std::make_shared<Peer>(m_QueueCapacity, m_QueuePolicy);
+    }
+
+    updateConnections([&hdl, &peer](ConnectionList &connections) {
+        connections.emplace(hdl, peer);
+    });
 
     try {
         onConnected(hdl);
     }
     catch (std::exception &ex) {
-        std::cerr << "Failed during onConnected, error '%s'."<< ex.what() << std::endl;
+        Logger::error("Failed during onConnected, error '%s'.", ex.what());
     }
 }
 
 void WebSocketServer::onFail(websocketpp::connection_hdl hdl) {
     Server::connection_ptr con = m_Server->get_con_from_hdl(hdl);
     std::string error_message = con->get_ec().message();
-    std::cerr << "Failed while trying to connect. %s" << error_message.c_str() << std::endl;
+    Logger::warning("Failed while trying to connect, error '%s'.", error_message.c_str());
 
-    m_ConnectionList.erase(hdl);
+    updateConnections([&hdl](ConnectionList &connections) {
+        connections.erase(hdl);
+    });
 }
 
 void WebSocketServer::onClose(websocketpp::connection_hdl hdl) {
@@ -154,17 +290,43 @@ void WebSocketServer::onClose(websocketpp::connection_hdl hdl) {
         onDisconnected(hdl);
     }
     catch (std::exception &ex) {
-        std::cerr << "Failed during onDisconnected, error '%s'." << ex.what() << std::endl;
+        Logger::error("Failed during onDisconnected, error '%s'.", ex.what());
     }
 
-    m_ConnectionList.erase(hdl);
+    updateConnections([&hdl](ConnectionList &connections) {
+        connections.erase(hdl);
+    });
 }
 
 void WebSocketServer::onMessageReceived(websocketpp::connection_hdl hdl, Server::message_ptr msg) {
+    LatencyMonitor::CommandScope command;
+    Trace::Span span("receive", "net");
+
+    try {
+        if (m_MessageHandler) {
+            m_MessageHandler(msg->get_payload(), hdl);
+        }
+    }
+    catch (std::exception &ex) {
+        Logger::error("Failed during onMessage, error '%s'.", ex.what());
+    }
+}
+
+void WebSocketServer::onHttp(websocketpp::connection_hdl hdl) {
+    Server::connection_ptr con = m_Server->get_con_from_hdl(hdl);
+
     try {
-        onMessage(msg->get_payload());
+        if (con->get_resource() == "/metrics") {
+            con->set_status(websocketpp::http::status_code::ok);
+            con->append_header("Content-Type", Metrics::contentType());
+            con->set_body(Metrics::render());
+        } else {
+            con->set_status(websocketpp::http::status_code::not_found);
+            con->set_body("Not found\n");
+        }
     }
     catch (std::exception &ex) {
-        std::cerr << "Failed during onMessage, error '%s'." << ex.what() << std::endl;
+        Logger::error("Failed during onHttp, error '%s'.", ex.what());
+        con->set_status(websocketpp::http::status_code::internal_server_error);
     }
 }
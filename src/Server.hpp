@@ -2,10 +2,15 @@
 
 #include <boost/signals2/signal.hpp>
 
+#include "SendQueue.hpp"
+
 #include <memory>
 #include <string>
-#include <set>
+#include <map>
+#include <vector>
+#include <functional>
 
+#include <atomic>
 #include <thread>
 #include <condition_variable>
 #include <mutex>
@@ -15,6 +20,7 @@
 #pragma warning(disable : 4267)
 #include <websocketpp/config/asio_no_tls.hpp>
 #include <websocketpp/server.hpp>
+#include <websocketpp/processors/hybi13.hpp>
 #pragma warning(pop)
 
 /// Simple tcp connection class that will keep a connection as long it lives and sent and receive asynchronous messages
@@ -24,9 +30,12 @@ public:
 
     ~WebSocketServer();
 
-    /// A message has been received.
-    /// The message itself is passed a std::string even if the message is binary object.
-    boost::signals2::signal<void(const std::string &)> onMessage;
+    /// Called for every received message, the message itself is passed a std::string even if it is binary.
+    /// The sending connection is passed as second argument.
+    typedef std::function<void(const std::string &, websocketpp::connection_hdl)> MessageHandler;
+
+    /// Install the message handler. Runs on the io thread and is called directly, without the locking of a signal.
+    void setMessageHandler(MessageHandler handler);
 
     /// A client has connected.
     /// The connection handle is passed as first argument.
@@ -42,10 +51,26 @@ public:
     void send(const std::string &message, websocketpp::connection_hdl hdl = websocketpp::connection_hdl());
 
     /// Send a message to all registered connections.
+    /// A broadcast is framed once and the same prepared frame is queued on every connection.
     /// @param message Message to send.
     /// @param hdl If not empty the message will only be sent to this connection.
+    /// @param opcode Frame type, binary for encoded payloads.
+    /// @param key Messages with the same key coalesce in the queues under DropPolicy::Coalesce.
     void send(std::shared_ptr<const std::string> message,
-              websocketpp::connection_hdl hdl = websocketpp::connection_hdl());
+              websocketpp::connection_hdl hdl = websocketpp::connection_hdl(),
+              websocketpp::frame::opcode::value opcode = websocketpp::frame::opcode::TEXT,
+              int key = NoSendKey);
+
+    /// Number of open connections.
+    size_t getConnectionCount() const;
+
+    /// Bound the send queue of every connection. When a queue is full the policy decides which message goes.
+    /// Messages stay queued while a socket has more than highWater bytes unsent.
+    /// Applies to connections opened afterwards.
+    void setSendQueue(size_t capacity, DropPolicy policy, size_t highWater);
+
+    /// Summed depth and drop count of the send queues of all open connections.
+    SendQueueStats getSendQueueStats() const;
 
     typedef websocketpp::server<websocketpp::config::asio> Server;
 
@@ -61,22 +86,65 @@ public:
     /// Called on a received message.
     virtual void onMessageReceived(websocketpp::connection_hdl hdl, Server::message_ptr msg);
 
+    /// Called on a plain HTTP request, serves Metrics::render() on /metrics.
+    virtual void onHttp(websocketpp::connection_hdl hdl);
+
     void setMaxMessageSize(size_t newSize);
 
 private:
-    typedef std::set<websocketpp::connection_hdl, std::owner_less<websocketpp::connection_hdl>> ConnectionList;
+    /// Per connection state.
+    struct Peer {
+        Peer(size_t capacity, DropPolicy policy) : queue(capacity, policy) {
+        }
 
-    /// List of WebSocket connections.
-    ConnectionList m_ConnectionList;
+        /// Framed messages waiting for the socket, only touched by the worker thread.
+        SendQueue<Server::message_ptr> queue;
+    };
+
+    typedef std::map<websocketpp::connection_hdl, std::shared_ptr<Peer>,
+                     std::owner_less<websocketpp::connection_hdl>> ConnectionList;
+    typedef std::shared_ptr<const ConnectionList> ConnectionListPtr;
+    typedef websocketpp::processor::hybi13<websocketpp::config::asio> FrameProcessor;
+
+    /// Copy the connection list, apply change and publish the copy. Readers never block.
+    void updateConnections(const std::function<void(ConnectionList &)> &change);
+
+    /// Frame a payload once so it can be queued on any number of connections.
+    Server::message_ptr prepareMessage(const std::string &payload, websocketpp::frame::opcode::value opcode);
+
+    /// Immutable snapshot of the WebSocket connections, replaced as a whole with std::atomic_store.
+    ConnectionListPtr m_ConnectionList;
+    /// Serializes writers of m_ConnectionList.
+    std::mutex m_ConnectionMutex;
+
+    /// Server side framing, only used by the worker thread.
+    websocketpp::config::asio::con_msg_manager_type::ptr m_MessageManager;
+    websocketpp::config::asio::rng_type m_Rng;
+    std::unique_ptr<FrameProcessor> m_FrameProcessor;
 
     /// WebSocket server.
     std::shared_ptr<Server> m_Server;
 
     std::atomic<bool> m_Running;
-    std::mutex m_mutex;
+
+    /// Only touched on the io thread.
+    MessageHandler m_MessageHandler;
+    mutable std::mutex m_mutex;
     std::condition_variable m_not_empty;
-    /// Queue for send
-    std::deque<std::pair<std::shared_ptr<const std::string>, websocketpp::connection_hdl>> m_Work;
+    /// Queued message with its target, frame type and coalescing key.
+    struct Outgoing {
+        std::shared_ptr<const std::string> message;
+        websocketpp::connection_hdl hdl;
+        websocketpp::frame::opcode::value opcode;
+        int key;
+    };
+
+    /// Bounded queue for send, fanned out to the connection queues by the worker. Guarded by m_mutex.
+    SendQueue<Outgoing> m_Work;
+    size_t m_QueueCapacity;
+    DropPolicy m_QueuePolicy;
+    /// Unsent bytes in websocketpp above which messages wait in the connection queue.
+    size_t m_HighWater;
     /// Worker thread
     std::thread m_WorkerThread;
 
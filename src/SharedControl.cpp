@@ -0,0 +1,304 @@
+#include "SharedControl.hpp"
+
+#include "LatencyMonitor.hpp"
+#include "Logger.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+constexpr uint32_t SharedControl::Version;
+constexpr size_t SharedControl::RingSize;
+constexpr size_t SharedControl::MaxCommand;
+constexpr size_t SharedControl::MaxRigs;
+
+namespace {
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<int32_t>::is_always_lock_free &&
+              std::atomic<int64_t>::is_always_lock_free, "shared atomics must be lock-free");
+static_assert((SharedControl::RingSize & (SharedControl::RingSize - 1)) == 0, "ring size must divide 2^32");
+
+const char Magic[4] = {'R', 'S', 'C', 'M'};
+
+/// Keep polling this long after a command, a burst of commands then never parks the thread.
+const std::chrono::microseconds SpinTime(200);
+
+enum StateField {
+    PitchPosition, YawPosition, PitchVector, YawVector, Focus, Zoom, Flags
+};
+
+enum StateFlag {
+    IrCut = 1, Busy = 2, Homed = 4, Tracking = 8
+};
+
+int64_t steadyNanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// Sleep until word no longer holds expected, a wake() or the timeout. Shared futexes work between processes.
+void parkOn(std::atomic<uint32_t> &word, uint32_t expected, std::chrono::nanoseconds timeout) {
+#if defined(__linux__)
+    struct timespec relative;
+    relative.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+    relative.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT, expected, &relative, nullptr, 0);
+#else
+    (void) word;
+    (void) expected;
+    std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(timeout, std::chrono::milliseconds(1)));
+#endif
+}
+
+void wake(std::atomic<uint32_t> &word) {
+#if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+#else
+    (void) word;
+#endif
+}
+
+SharedControl::Block *map(int fd, const std::string &name) {
+    void *memory = mmap(nullptr, sizeof(SharedControl::Block), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (memory == MAP_FAILED) {
+        throw std::runtime_error("Cannot map shared memory '" + name + "': " + strerror(errno));
+    }
+    return static_cast<SharedControl::Block *>(memory);
+}
+
+}
+
+SharedControl::Sender::Sender(const std::string &name) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open shared memory '" + name + "': " + strerror(errno));
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(Block)) {
+        close(fd);
+        throw std::runtime_error("Shared memory '" + name + "' is not a rig control block");
+    }
+
+    m_Block = map(fd, name);
+
+    if (m_Block->version.load(std::memory_order_acquire) != Version || memcmp(m_Block->magic, Magic, sizeof(Magic))) {
+        munmap(m_Block, sizeof(Block));
+        throw std::runtime_error("Shared memory '" + name + "' is not a rig control block");
+    }
+}
+
+SharedControl::Sender::~Sender() {
+    munmap(m_Block, sizeof(Block));
+}
+
+bool SharedControl::Sender::send(const char *command, size_t length) {
+    uint32_t head = m_Block->head.load(std::memory_order_relaxed);
+
+    if (length > MaxCommand || head - m_Block->tail.load(std::memory_order_acquire) >= RingSize) {
+        return false;
+    }
+
+    Slot &slot = m_Block->slots[head % RingSize];
+    slot.length = static_cast<uint8_t>(length);
+    memcpy(slot.text, command, length);
+
+    // sequentially consistent with the parked flag, either the rig sees the new head or we see it parked
+    m_Block->head.store(head + 1, std::memory_order_seq_cst);
+    if (m_Block->parked.load(std::memory_order_seq_cst)) {
+        wake(m_Block->head);
+    }
+    return true;
+}
+
+bool SharedControl::Sender::read(unsigned rig, State &state) const {
+    if (rig >= m_Block->rigCount.load(std::memory_order_relaxed)) {
+        return false;
+    }
+
+    auto &fields = m_Block->state[rig];
+    std::array<int32_t, 8> copy;
+
+    while (true) {
+        uint32_t before = m_Block->sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        for (size_t i = 0; i < copy.size(); i++) {
+            copy[i] = fields[i].load(std::memory_order_relaxed);
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_Block->sequence.load(std::memory_order_relaxed) == before) {
+            break;
+        }
+    }
+
+    state.pitchPosition = copy[PitchPosition];
+    state.yawPosition = copy[YawPosition];
+    state.pitchVector = copy[PitchVector];
+    state.yawVector = copy[YawVector];
+    state.focus = copy[Focus];
+    state.zoom = copy[Zoom];
+    state.irCut = (copy[Flags] & IrCut) != 0;
+    state.busy = (copy[Flags] & Busy) != 0;
+    state.homed = (copy[Flags] & Homed) != 0;
+    state.tracking = (copy[Flags] & Tracking) != 0;
+    return true;
+}
+
+SharedControl::SharedControl(const std::string &name, unsigned rigCount,
+                             std::function<void(const std::string &)> handler, StateSource source,
+                             std::chrono::milliseconds publishInterval)
+        : m_Name(name), m_RigCount(std::min<unsigned>(rigCount, MaxRigs)), m_Handler(std::move(handler)),
+          m_Source(std::move(source)), m_PublishInterval(publishInterval), m_Running(true), m_Received(0),
+          m_Malformed(0) {
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0660);
+
+    if (fd < 0) {
+        throw std::runtime_error("Cannot create shared memory '" + name + "': " + strerror(errno));
+    }
+
+    if (ftruncate(fd, sizeof(Block)) != 0) {
+        close(fd);
+        throw std::runtime_error("Cannot size shared memory '" + name + "': " + strerror(errno));
+    }
+
+    m_Block = map(fd, name);
+
+    // a block left by an earlier run is taken over, senders see it invalid until it is set up again
+    m_Block->version.store(0, std::memory_order_release);
+    memcpy(m_Block->magic, Magic, sizeof(Magic));
+    m_Block->rigCount.store(m_RigCount, std::memory_order_relaxed);
+    m_Block->head.store(0, std::memory_order_relaxed);
+    m_Block->tail.store(0, std::memory_order_relaxed);
+    m_Block->parked.store(0, std::memory_order_relaxed);
+    m_Block->sequence.store(0, std::memory_order_relaxed);
+    publish();
+    m_Block->version.store(Version, std::memory_order_release);
+
+    if (rigCount > MaxRigs) {
+        Logger::warning("Shared memory control publishes the state of the first %zu rigs only", MaxRigs);
+    }
+
+    m_Thread = std::thread([this]() {
+        Trace::setThreadName("shared control");
+        loop();
+    });
+}
+
+SharedControl::~SharedControl() {
+    m_Running = false;
+    wake(m_Block->head);
+    m_Thread.join();
+
+    m_Block->version.store(0, std::memory_order_release);
+    munmap(m_Block, sizeof(Block));
+    shm_unlink(m_Name.c_str());
+}
+
+void SharedControl::publish() {
+    std::array<std::array<int32_t, 8>, MaxRigs> values = {};
+
+    // sample first, the sequence stays odd only for the stores
+    for (unsigned rig = 0; rig < m_RigCount; rig++) {
+        State state;
+        if (!m_Source(rig, state)) {
+            continue;
+        }
+
+        values[rig][PitchPosition] = state.pitchPosition;
+        values[rig][YawPosition] = state.yawPosition;
+        values[rig][PitchVector] = state.pitchVector;
+        values[rig][YawVector] = state.yawVector;
+        values[rig][Focus] = state.focus;
+        values[rig][Zoom] = state.zoom;
+        values[rig][Flags] = (state.irCut ? IrCut : 0) | (state.busy ? Busy : 0) | (state.homed ? Homed : 0) |
+                             (state.tracking ? Tracking : 0);
+    }
+
+    uint32_t sequence = m_Block->sequence.load(std::memory_order_relaxed);
+    m_Block->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (unsigned rig = 0; rig < m_RigCount; rig++) {
+        for (size_t i = 0; i < values[rig].size(); i++) {
+            m_Block->state[rig][i].store(values[rig][i], std::memory_order_relaxed);
+        }
+    }
+    m_Block->published.store(steadyNanoseconds(), std::memory_order_relaxed);
+
+    m_Block->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+void SharedControl::loop() {
+    auto now = std::chrono::steady_clock::now();
+    auto nextPublish = now + m_PublishInterval;
+    auto spinUntil = now;
+
+    while (m_Running) {
+        uint32_t tail = m_Block->tail.load(std::memory_order_relaxed);
+        uint32_t head = m_Block->head.load(std::memory_order_acquire);
+
+        if (head != tail) {
+            for (; tail != head; tail++) {
+                LatencyMonitor::CommandScope command;
+                Trace::Span span("shm receive", "net");
+
+                const Slot &slot = m_Block->slots[tail % RingSize];
+                if (slot.length > MaxCommand) {
+                    m_Malformed++;
+                    continue;
+                }
+
+                std::string message(slot.text, slot.length);
+                // hand the slot back before acting, the command may take a while
+                m_Block->tail.store(tail + 1, std::memory_order_release);
+                m_Received++;
+                m_Handler(message);
+            }
+            m_Block->tail.store(tail, std::memory_order_release);
+
+            publish();
+            now = std::chrono::steady_clock::now();
+            nextPublish = now + m_PublishInterval;
+            spinUntil = now + SpinTime;
+            continue;
+        }
+
+        now = std::chrono::steady_clock::now();
+        if (now >= nextPublish) {
+            publish();
+            nextPublish = now + m_PublishInterval;
+        }
+
+        if (now < spinUntil) {
+            continue;
+        }
+
+        // sequentially consistent with the sender, see Sender::send()
+        m_Block->parked.store(1, std::memory_order_seq_cst);
+        if (m_Block->head.load(std::memory_order_seq_cst) == tail && m_Running) {
+            parkOn(m_Block->head, tail, nextPublish - now);
+        }
+        m_Block->parked.store(0, std::memory_order_relaxed);
+    }
+}
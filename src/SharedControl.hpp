@@ -0,0 +1,140 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+
+/// Local control for processes on the same machine, e.g. a vision process driving the tracker.
+///
+/// Both sides map one POSIX shared memory object. Commands travel in a single producer, single consumer ring from
+/// the local process to the rig and feed the same dispatch as websocket messages. Rig state travels back in a block
+/// guarded by a sequence lock, so readers never block the rig and the rig never waits for a reader. Neither path
+/// makes a system call while the rig is busy: the command thread spins for a while after each command and only
+/// parks on a futex when the ring stays empty, the sender wakes it only in that case.
+///
+/// Layout of the object (SharedControl::Block):
+///   "RSCM", version, command ring of 256 slots of up to 63 bytes, state of up to 8 rigs.
+/// A command is the text of a websocket message, "N:" prefixes address rig N. A restarted rig creates a new object,
+/// senders reopen it once the published stamp stops moving.
+class SharedControl {
+public:
+    static constexpr uint32_t Version = 1;
+    static constexpr size_t RingSize = 256;
+    static constexpr size_t MaxCommand = 63;
+    static constexpr size_t MaxRigs = 8;
+
+    /// Published state of one rig, see RigState.
+    struct State {
+        int32_t pitchPosition;
+        int32_t yawPosition;
+        int32_t pitchVector;
+        int32_t yawVector;
+        int32_t focus;
+        int32_t zoom;
+        bool irCut;
+        bool busy;
+        bool homed;
+        bool tracking;
+    };
+
+    /// Written before head moves past it, so it needs no atomics of its own.
+    struct alignas(64) Slot {
+        uint8_t length;
+        char text[MaxCommand];
+    };
+
+    /// Everything in here is lock-free atomics, which are address free and work between processes.
+    struct Block {
+        char magic[4];
+        std::atomic<uint32_t> version;
+        std::atomic<uint32_t> rigCount;
+
+        /// Ring indices count forever and wrap at 2^32, the slot is index % RingSize.
+        alignas(64) std::atomic<uint32_t> head;
+        /// Non-zero while the command thread is parked on head, a sender has to wake it.
+        std::atomic<uint32_t> parked;
+        alignas(64) std::atomic<uint32_t> tail;
+        Slot slots[RingSize];
+
+        /// Odd while the rig writes the state.
+        alignas(64) std::atomic<uint32_t> sequence;
+        std::atomic<int64_t> published;     ///< steady clock nanoseconds of the last publish
+        /// Per rig: pitch and yaw position, pitch and yaw vector, focus, zoom, flags (State bools from bit 0), unused.
+        std::array<std::array<std::atomic<int32_t>, 8>, MaxRigs> state;
+    };
+
+    /// Local process side. Not thread safe, one sender per object.
+    class Sender {
+    public:
+        /// Map an object created by the rig. Throws std::runtime_error if there is none or it is not a control block.
+        explicit Sender(const std::string &name);
+
+        ~Sender();
+
+        Sender(const Sender &) = delete;
+        Sender &operator=(const Sender &) = delete;
+
+        /// Queue a command, false if it is too long or the ring is full.
+        bool send(const char *command, size_t length);
+
+        bool send(const std::string &command) {
+            return send(command.data(), command.size());
+        }
+
+        /// Consistent copy of the state of a rig, false if there is no such rig.
+        bool read(unsigned rig, State &state) const;
+
+        /// Steady clock nanoseconds of the last state publish, moves at least every publish interval.
+        int64_t getPublished() const {
+            return m_Block->published.load(std::memory_order_relaxed);
+        }
+
+    private:
+        Block *m_Block;
+    };
+
+    /// Gives the state of a rig at publish time, false if there is no such rig.
+    typedef std::function<bool(unsigned rig, State &state)> StateSource;
+
+    /// Create or take over the object name (e.g. "/rig-control") and start the command thread. Every command is passed
+    /// to handler on that thread, state of rigCount rigs is published after commands and every publish interval.
+    /// Throws std::runtime_error if the object cannot be created.
+    SharedControl(const std::string &name, unsigned rigCount, std::function<void(const std::string &)> handler,
+                  StateSource source, std::chrono::milliseconds publishInterval = std::chrono::milliseconds(10));
+
+    /// Stops the thread and removes the object.
+    ~SharedControl();
+
+    SharedControl(const SharedControl &) = delete;
+    SharedControl &operator=(const SharedControl &) = delete;
+
+    uint64_t getReceived() const {
+        return m_Received;
+    }
+
+    /// Commands longer than a slot, only a broken sender writes those.
+    uint64_t getMalformed() const {
+        return m_Malformed;
+    }
+
+private:
+    void loop();
+
+    void publish();
+
+    std::string m_Name;
+    Block *m_Block;
+    unsigned m_RigCount;
+    std::function<void(const std::string &)> m_Handler;
+    StateSource m_Source;
+    std::chrono::milliseconds m_PublishInterval;
+
+    std::atomic<bool> m_Running;
+    std::atomic<uint64_t> m_Received;
+    std::atomic<uint64_t> m_Malformed;
+    std::thread m_Thread;
+};
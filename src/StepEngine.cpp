@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <stdexcept>
+#include "StepEngine.hpp"
+#include "StepperMotor.hpp"
+#include "Trace.hpp"
+
+StepEngine::StepEngine(std::shared_ptr<Clock> clock)
+    : m_Clock(std::move(clock)), m_Wakeup(false), m_Running(true)
+{
+    if(!m_Clock->isSimulated())
+    {
+        m_Thread = std::thread([this]()
+        {
+            Trace::setThreadName("step engine");
+            loop();
+        });
+    }
+}
+
+StepEngine::~StepEngine()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_Running = false;
+
+        for(auto& motor : m_Motors)
+        {
+            motor->release();
+        }
+        m_Motors.clear();
+    }
+    m_wake.notify_one();
+
+    if(m_Thread.joinable())
+    {
+        m_Thread.join();
+    }
+}
+
+void StepEngine::add(const std::shared_ptr<StepperMotor>& motor)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        motor->m_Engine = this;
+        m_Motors.push_back(motor);
+        m_Wakeup = true;
+    }
+    m_wake.notify_one();
+}
+
+void StepEngine::remove(const std::shared_ptr<StepperMotor>& motor)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = std::find(m_Motors.begin(), m_Motors.end(), motor);
+    if(it != m_Motors.end())
+    {
+        motor->release();
+        motor->m_Engine = nullptr;
+        m_Motors.erase(it);
+    }
+}
+
+void StepEngine::wake()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_Wakeup = true;
+    }
+    m_wake.notify_one();
+}
+
+void StepEngine::setOnPass(std::function<void()> hook)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_OnPass = std::move(hook);
+        m_Wakeup = true;
+    }
+    m_wake.notify_one();
+}
+
+void StepEngine::runUntil(Clock::time_point deadline)
+{
+    if(!m_Clock->isSimulated())
+    {
+        throw std::logic_error("StepEngine::runUntil needs a simulated clock");
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for(auto next = serviceAll(m_Clock->now()); next <= deadline; next = serviceAll(m_Clock->now()))
+    {
+        m_Clock->sleepUntil(next);
+    }
+
+    m_Clock->sleepUntil(deadline);
+}
+
+Clock::time_point StepEngine::serviceAll(Clock::time_point now)
+{
+    Trace::Span span("step pass", "motion");
+    auto next = Clock::time_point::max();
+
+    for(auto& motor : m_Motors)
+    {
+        next = std::min(next, motor->service(now));
+    }
+
+    if(m_OnPass)
+    {
+        m_OnPass();
+    }
+    return next;
+}
+
+void StepEngine::loop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while(m_Running)
+    {
+        // clear before servicing, a vector changed during the pass is picked up by the next one
+        m_Wakeup = false;
+
+        auto next = serviceAll(m_Clock->now());
+
+        auto woken = [this]()
+        {
+            return m_Wakeup || !m_Running;
+        };
+
+        if(next == Clock::time_point::max())
+        {
+            m_wake.wait(lock, woken);
+        }
+        else
+        {
+            m_wake.wait_until(lock, next, woken);
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Clock.hpp"
+
+class StepperMotor;
+
+// Single timing loop for the coils of every registered stepper.
+// Each motor reports when its next half step is due and the engine sleeps until the earliest
+// deadline, so any number of heads share one thread instead of one sleeping thread per motor.
+//
+// On a simulated clock there is no thread, the owner calls runUntil() and every half step
+// happens at its exact virtual time, as fast as the CPU allows.
+class StepEngine
+{
+public:
+    explicit StepEngine(std::shared_ptr<Clock> clock = Clock::system());
+    ~StepEngine();
+
+    const std::shared_ptr<Clock>& getClock() const
+    {
+        return m_Clock;
+    }
+
+    // Simulated clocks only: take every half step due up to deadline on the calling thread,
+    // advancing the clock from step to step and finally to deadline
+    void runUntil(Clock::time_point deadline);
+
+    // Start driving the motor, its async vector takes effect from now on
+    void add(const std::shared_ptr<StepperMotor>& motor);
+    // Release the coils and stop driving the motor
+    void remove(const std::shared_ptr<StepperMotor>& motor);
+
+    // A vector changed, recompute the deadlines right away
+    void wake();
+
+    // Called on the engine thread after every pass with the engine lock held, e.g. to persist positions.
+    // Stepper calls from the hook deadlock, reading motor state is fine.
+    void setOnPass(std::function<void()> hook);
+private:
+    void loop();
+
+    // Service every motor at now and return the earliest next deadline. Called with m_mutex held.
+    Clock::time_point serviceAll(Clock::time_point now);
+
+    std::shared_ptr<Clock> m_Clock;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_Wakeup;
+    bool m_Running;
+    std::vector<std::shared_ptr<StepperMotor>> m_Motors;
+    std::function<void()> m_OnPass;
+    std::thread m_Thread;
+};
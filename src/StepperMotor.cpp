@@ -1,14 +1,20 @@
-#if RASPI == 1
 #include <cassert>
 #include <cstdlib>
 #include <cmath>
 #include <algorithm>
-#include <wiringPi.h>
-#include <wiringPiI2C.h>
+#include "Gpio.hpp"
+#include "LatencyMonitor.hpp"
+#include "Metrics.hpp"
 #include "StepperMotor.hpp"
 
 using namespace std;
 
+static Metrics::Counter StepsTaken("rig_steps_total", "Half steps taken by all stepper axes");
+static Metrics::Counter DeadlinesMissed("rig_step_deadlines_missed_total",
+                                       "Half steps taken a whole period or more after they were due");
+static Metrics::Counter BacklashSteps("rig_backlash_steps_total",
+                                     "Half steps spent taking up gear backlash after a reversal");
+
 // Switching sequence for the 28BYJ48 (clockwise)
 static const bool SEQUENCE[8][4] =
 {
@@ -27,12 +33,6 @@ static const float stepAngle = 0.0883268076179f;
 
 StepperMotor::~StepperMotor()
 {
-    if(thread && thread->joinable())
-    {
-        m_Run = false;
-        moveVector = 0;
-        thread->join();
-    }
 }
 
 // Default constructor
@@ -64,56 +64,298 @@ StepperMotor::StepperMotor()
     currentSequence = sequence;
 
     moveVector = 0;
-    m_Run = true;
+    m_Interval = 0;
+    m_StepPosition = 0;
+    m_ActuationStamp = 0;
+    m_Engine = nullptr;
+    m_Targeting = false;
+    m_Target = 0;
+    m_Limited = false;
+    m_MinLimit = 0;
+    m_MaxLimit = 0;
+#if RASPI != 1
+    m_SimMinPin = m_SimMaxPin = -1;
+    m_SimMinPosition = m_SimMaxPosition = 0;
+    m_SimShift = 0;
+#endif
+    m_Backlash = 0;
+    m_TakeUpInterval = m_Linear.interval(ResponseCurve::MaxVector);
+    m_Energized = false;
+    m_Phase = 0;
+    m_Direction = 0;
+    m_TakeUp = 0;
+}
+
+/// set the async move vector.
+void StepperMotor::run_async(int vector)
+{
+    bool changed;
+    {
+        std::lock_guard<std::mutex> lock(m_MoveMutex);
+        m_Targeting = false;
+        changed = setVector(vector, m_Linear.interval(vector));
+    }
+
+    if(changed)
+    {
+        wakeEngine();
+    }
+}
+
+void StepperMotor::jog(int vector)
+{
+    bool changed;
+    {
+        std::lock_guard<std::mutex> lock(m_MoveMutex);
+        uint32_t interval = m_Response.interval(vector);
+        m_Targeting = false;
+        changed = setVector(interval == 0 ? 0 : vector, interval);
+    }
+
+    if(changed)
+    {
+        wakeEngine();
+    }
+}
+
+void StepperMotor::setResponseCurve(const ResponseCurve& curve)
+{
+    std::lock_guard<std::mutex> lock(m_MoveMutex);
+    m_Response = ResponseCurve(curve.getShape(), m_Linear.getBands());
+}
+
+void StepperMotor::setResonanceBands(const std::vector<ResponseCurve::Band>& bands)
+{
+    // compile both before replacing either, a rejected band leaves the axis as it was
+    ResponseCurve linear(ResponseCurve::linear(), bands);
+
+    std::lock_guard<std::mutex> lock(m_MoveMutex);
+    ResponseCurve response(m_Response.getShape(), bands);
+    m_Linear = linear;
+    m_Response = response;
+    m_TakeUpInterval = m_Linear.interval(ResponseCurve::MaxVector);
+}
+
+std::chrono::microseconds StepperMotor::period(int vector)
+{
+    std::lock_guard<std::mutex> lock(m_MoveMutex);
+    return std::chrono::microseconds(m_Linear.interval(vector));
+}
 
-    thread = std::make_shared<std::thread>([this]()
+void StepperMotor::run_to(int position, int vector)
+{
+    bool changed;
     {
-        int count = 0;
+        std::lock_guard<std::mutex> lock(m_MoveMutex);
+        int distance = position - m_StepPosition;
 
-        while(m_Run)
+        if(m_Limited)
         {
-            count = 0;
-            bool wasRunning = false;
-
-            while(moveVector != 0)
-            {
-                wasRunning = true;
-                digitalWrite(in1, (*currentSequence)[count][0] ? HIGH : LOW);
-                digitalWrite(in2, (*currentSequence)[count][1] ? HIGH : LOW);
-                digitalWrite(in3, (*currentSequence)[count][2] ? HIGH : LOW);
-                digitalWrite(in4, (*currentSequence)[count][3] ? HIGH : LOW);
-
-                if(++count == 8)
-                {
-                    count = 0;
-                }
-
-                delayMicroseconds(td); // minimum delay 5ms (speed 100%), maximum delay 25ms (speed 20%)
-            }
-
-            if (wasRunning)
-            {
-                // Cleanup (recommended in order to prevent stepper motor overheating)
-                digitalWrite(in1, LOW);
-                digitalWrite(in2, LOW);
-                digitalWrite(in3, LOW);
-                digitalWrite(in4, LOW);
-            }
-
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            position = std::min(std::max(position, m_MinLimit), m_MaxLimit);
+            distance = position - m_StepPosition;
         }
-    });
+
+        // the engine compares positions exactly, so it arrives even if a step was in flight while planning
+        m_Target = position;
+        m_Targeting = distance != 0;
+        changed = setVector(distance == 0 ? 0 : (distance > 0 ? std::abs(vector) : -std::abs(vector)),
+                            m_Linear.interval(vector));
+    }
+
+    if(changed)
+    {
+        wakeEngine();
+    }
 }
 
-/// set the async move vector.
-void StepperMotor::run_async(int vector)
+void StepperMotor::shiftPosition(int offset)
+{
+    std::lock_guard<std::mutex> lock(m_MoveMutex);
+    m_StepPosition -= offset;
+    m_Target -= offset;
+#if RASPI != 1
+    m_SimShift += offset;
+#endif
+}
+
+void StepperMotor::setSoftLimits(int minimum, int maximum)
+{
+    std::lock_guard<std::mutex> lock(m_MoveMutex);
+    m_MinLimit = minimum;
+    m_MaxLimit = maximum;
+    m_Limited = true;
+}
+
+void StepperMotor::clearSoftLimits()
+{
+    std::lock_guard<std::mutex> lock(m_MoveMutex);
+    m_Limited = false;
+}
+
+bool StepperMotor::getSoftLimits(int& minimum, int& maximum)
 {
-    if (moveVector != vector)
+    std::lock_guard<std::mutex> lock(m_MoveMutex);
+    minimum = m_MinLimit;
+    maximum = m_MaxLimit;
+    return m_Limited;
+}
+
+void StepperMotor::setPhase(unsigned phase)
+{
+    m_Phase = phase % 8;
+}
+
+void StepperMotor::setBacklash(unsigned halfSteps)
+{
+    m_Backlash = halfSteps;
+}
+
+#if RASPI != 1
+void StepperMotor::simulateEndStops(int minPin, int minPosition, int maxPin, int maxPosition)
+{
+    m_SimMinPin = minPin;
+    m_SimMinPosition = minPosition;
+    m_SimMaxPin = maxPin;
+    m_SimMaxPosition = maxPosition;
+}
+#endif
+
+bool StepperMotor::setVector(int vector, uint32_t interval)
+{
+    if (moveVector == vector && m_Interval == interval)
+    {
+        return false;
+    }
+
+    m_ActuationStamp = LatencyMonitor::currentCommand();
+    // the engine reads the vector first, so it never steps a new vector at the old interval
+    m_Interval = interval;
+    moveVector = vector;
+    return true;
+}
+
+void StepperMotor::wakeEngine()
+{
+    StepEngine* engine = m_Engine;
+    if(engine)
+    {
+        engine->wake();
+    }
+}
+
+Clock::time_point StepperMotor::service(Clock::time_point now)
+{
+    if(m_Targeting || m_Limited)
+    {
+        std::lock_guard<std::mutex> lock(m_MoveMutex);
+        int position = m_StepPosition;
+        int current = moveVector;
+        bool arrived = m_Targeting && position == m_Target;
+        bool limited = m_Limited && ((current > 0 && position >= m_MaxLimit) || (current < 0 && position <= m_MinLimit));
+        if(arrived || limited)
+        {
+            m_Targeting = false;
+            moveVector = 0;
+        }
+    }
+
+    int vector = moveVector;
+    uint32_t interval = m_Interval;
+
+    if(vector == 0)
     {
-        moveVector = vector;
-        td = (5 * 100 / (float)std::abs(vector)) * 1000;
-        currentSequence = vector > 0 ? sequence : rsequence;
+        if(m_Energized)
+        {
+            release();
+
+            // a stop command actuates by releasing the coils
+            LatencyMonitor::instance().record(LatencyMonitor::Actuate, m_ActuationStamp.exchange(0));
+        }
+        return Clock::time_point::max();
     }
+
+    // A reversal first winds the gear train through its slack. Those steps turn the rotor but not the output,
+    // so they run at full speed and leave the position alone. Reversing again part way only has to undo
+    // what was taken up so far.
+    int direction = vector > 0 ? 1 : -1;
+    if(m_Direction != 0 && direction != m_Direction)
+    {
+        unsigned backlash = m_Backlash;
+        m_TakeUp = backlash - std::min(m_TakeUp, backlash);
+    }
+    m_Direction = direction;
+
+    bool takingUp = m_TakeUp > 0;
+    auto period = std::chrono::microseconds(takingUp ? m_TakeUpInterval.load() : interval);
+    auto due = m_LastStep + period;
+
+    if(m_Energized && now < due)
+    {
+        return due;
+    }
+
+    // walking the sequence backwards reverses the motor from whatever phase it is in. Advance before writing,
+    // the rotor sits at the phase on the coils and the first step of a reversal has to go back from there.
+    unsigned phase = (m_Phase + (vector > 0 ? 1 : 7)) % 8;
+    m_Phase = phase;
+
+    digitalWrite(in1, SEQUENCE[phase][0] ? HIGH : LOW);
+    digitalWrite(in2, SEQUENCE[phase][1] ? HIGH : LOW);
+    digitalWrite(in3, SEQUENCE[phase][2] ? HIGH : LOW);
+    digitalWrite(in4, SEQUENCE[phase][3] ? HIGH : LOW);
+
+    if(takingUp)
+    {
+        m_TakeUp--;
+        BacklashSteps.add();
+    }
+    else
+    {
+        m_StepPosition += direction;
+    }
+
+#if RASPI != 1
+    if(!takingUp && (m_SimMinPin >= 0 || m_SimMaxPin >= 0))
+    {
+        int physical = m_StepPosition + m_SimShift;
+        virtualPinWrite(m_SimMinPin, physical <= m_SimMinPosition ? LOW : HIGH);
+        virtualPinWrite(m_SimMaxPin, physical >= m_SimMaxPosition ? LOW : HIGH);
+    }
+#endif
+
+    if(m_ActuationStamp.load(std::memory_order_relaxed) != 0)
+    {
+        LatencyMonitor::instance().record(LatencyMonitor::Actuate, m_ActuationStamp.exchange(0));
+    }
+
+    StepsTaken.add();
+
+    // keep the cadence, but do not rush to catch up on steps the engine was late for
+    bool onTime = !m_Energized || now - due < period;
+    if(!onTime)
+    {
+        DeadlinesMissed.add();
+    }
+
+    m_LastStep = (m_Energized && onTime) ? due : now;
+    m_Energized = true;
+
+    return m_LastStep + period;
+}
+
+void StepperMotor::release()
+{
+    if(!m_Energized)
+    {
+        return;
+    }
+
+    // Cleanup (recommended in order to prevent stepper motor overheating)
+    digitalWrite(in1, LOW);
+    digitalWrite(in2, LOW);
+    digitalWrite(in3, LOW);
+    digitalWrite(in4, LOW);
+    m_Energized = false;
 }
 
 // Returns the number of steps associated to a certain angle
@@ -176,7 +418,7 @@ void StepperMotor::run(int direction, unsigned angle, unsigned speed)
     td = (5 * 100 / (float) speed) * 1000;
 
     // Set the right number of steps to do, taking in account of the threshold
-    if(abs(current_pos + direction * angle) > threshold && threshold != 0)
+    if(abs(current_pos + direction * (int) angle) > (int) threshold && threshold != 0)
     {
         ndegrees = threshold - direction * current_pos;
     }
@@ -225,6 +467,7 @@ void StepperMotor::run(int direction, unsigned angle, unsigned speed)
 
     // Update the state
     this->nsteps += nsteps;
+    m_StepPosition += direction * (int) nsteps;
     current_pos += direction * ndegrees;
     running = false;
 }
@@ -235,4 +478,3 @@ void StepperMotor::wait(unsigned milliseconds) const
 {
     delay(milliseconds);
 }
-#endif
\ No newline at end of file
@@ -4,10 +4,16 @@
 // the geared stepper motor 28BYJ48 through the ULN2003APG driver.
 //
 #pragma once
-#if RASPI == 1
 #include <vector>
 #include <thread>
 #include <atomic>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include "ResponseCurve.hpp"
+#include "StepEngine.hpp"
 
 using namespace std;
 
@@ -38,9 +44,75 @@ public:
     void run(int direction, unsigned angle, unsigned speed);
     void wait(unsigned milliseconds) const;
 
-    // run in the custom thread, can be called mutliple times to adjust vector = (direction and velocity).
+    // run on the StepEngine the motor was added to, can be called mutliple times to adjust vector = (direction and velocity).
     void run_async(int vector);
+    // run_async() for a velocity from an operator, shaped by the response curve of the axis. A vector inside
+    // its deadband stops the axis.
+    void jog(int vector);
+    // response of jog(), the other moves stay linear so their timing can be planned
+    void setResponseCurve(const ResponseCurve& curve);
+    // Step rates in half steps per second the axis never cruises at, for every kind of move. A rate inside a band
+    // runs at its nearer edge instead. Throws std::invalid_argument if the bands leave no rate, see ResponseCurve.
+    void setResonanceBands(const std::vector<ResponseCurve::Band>& bands);
+    // run on the StepEngine at |vector| until the half step position reaches position, then stop.
+    // run_async() cancels the move.
+    void run_to(int position, int vector);
+    // true while a run_to() move has not arrived
+    bool isTargeting() const
+    {
+        return m_Targeting;
+    }
+    // time between two half steps of run_async() and run_to() at vector, 5 ms at full speed and 0 at vector 0
+    std::chrono::microseconds period(int vector);
+    // current async move vector
+    int getVector() const
+    {
+        return moveVector;
+    }
+    // position in half steps counted by the async loop since power-on or the last homing
+    int getStepPosition() const
+    {
+        return m_StepPosition;
+    }
+    // Move the origin by offset half steps, the current position becomes position - offset
+    void shiftPosition(int offset);
+    // Stop at these half step positions when moving towards them, run_to() targets are clamped
+    void setSoftLimits(int minimum, int maximum);
+    void clearSoftLimits();
+    // false if no soft limits are set
+    bool getSoftLimits(int& minimum, int& maximum);
+    // Phase of the switching sequence the coils hold or held last, the rotor rests there while released
+    unsigned getPhase() const
+    {
+        return m_Phase;
+    }
+    // Resume at the phase the rotor was left at by an earlier process, only while the axis stands still
+    void setPhase(unsigned phase);
+    // Half steps the gearbox turns without moving the output after a reversal, taken up at full speed
+    // before the position counts again. 0 (the default) disables compensation.
+    void setBacklash(unsigned halfSteps);
+    unsigned getBacklash() const
+    {
+        return m_Backlash;
+    }
+#if RASPI != 1
+    // Desktop simulation: the virtual end-stop pins close while the axis is at or beyond the given positions.
+    // Positions are physical, shiftPosition() does not move the switches.
+    void simulateEndStops(int minPin, int minPosition, int maxPin, int maxPosition);
+#endif
 private:
+    friend class StepEngine;
+
+    // Take the half step that is due and return when the next one is, only called by the engine
+    Clock::time_point service(Clock::time_point now);
+    // Switch all coils off if energized, only called by the engine
+    void release();
+    // Change the move vector and its half step interval in microseconds, called with m_MoveMutex held. The caller
+    // wakes the engine after unlocking, the engine services motors with its own lock held and takes m_MoveMutex
+    // inside it.
+    bool setVector(int vector, uint32_t interval);
+    void wakeEngine();
+
     std::shared_ptr<vector<vector<bool>>> sequence;          // the switching sequence
     std::shared_ptr<vector<vector<bool>>> rsequence;         // the switching sequence backwards
     std::shared_ptr<std::vector<std::vector<bool>>> currentSequence;
@@ -50,10 +122,33 @@ private:
     unsigned nsteps;                        // total number of steps from the beginning
     unsigned in1, in2, in3, in4;            // stepper motor driver inputs
 
-    std::atomic<bool> m_Run;
     std::atomic<int> moveVector;
-    float td;
-    std::shared_ptr<std::thread> thread;
-};
+    std::atomic<uint32_t> m_Interval;       // microseconds between half steps at moveVector, stored before it
+    std::atomic<int> m_StepPosition;
+    std::atomic<int64_t> m_ActuationStamp;  // receive stamp of the last vector change until it reaches the coils
+    std::atomic<StepEngine*> m_Engine;
 
+    // run_to() target, changes to the vector and the target are serialized so the engine never
+    // stops a move that was just replaced
+    std::mutex m_MoveMutex;
+    std::atomic<bool> m_Targeting;
+    int m_Target;
+    std::atomic<bool> m_Limited;
+    int m_MinLimit;
+    int m_MaxLimit;
+    std::atomic<unsigned> m_Backlash;
+    ResponseCurve m_Response;               // guarded by m_MoveMutex like m_Linear
+    ResponseCurve m_Linear;                 // run_async() and run_to(), 2 vector half steps per second
+    std::atomic<uint32_t> m_TakeUpInterval; // backlash take-up runs at the full linear speed
+#if RASPI != 1
+    int m_SimMinPin, m_SimMinPosition, m_SimMaxPin, m_SimMaxPosition;
+    std::atomic<int> m_SimShift;            // origin shifts since power-on
 #endif
+
+    // async stepping state, owned by the engine thread
+    bool m_Energized;
+    std::atomic<unsigned> m_Phase;          // index into the switching sequence of the phase on the coils
+    Clock::time_point m_LastStep;
+    int m_Direction;                        // of the last half step, 0 before the first one
+    unsigned m_TakeUp;                      // backlash half steps left before the output moves
+};
@@ -1,5 +1,7 @@
 #include "StopWatch.hpp"
 
+#include <chrono>
+
 #if defined(BOOST_WINDOWS)
 #define VC_EXTRALEAN
 #define WIN32_LEAN_AND_MEAN
@@ -28,7 +30,7 @@ void StopWatch::start()
     QueryPerformanceCounter(&l);
     mStart = l.QuadPart;
 #else
-    mStart = std::chrono::high_resolution_clock::now();
+    mStart = std::chrono::steady_clock::now();
 #endif
 }
 
@@ -44,11 +46,8 @@ double StopWatch::restart()
     milliseconds *= 1000;
     mStart = now.QuadPart;
 #else
-    auto now = std::chrono::high_resolution_clock::now();
-    milliseconds =
-        static_cast<double>(std::chrono::duration_cast<std::chrono::microseconds>(now - mStart)
-                            .count());
-    milliseconds /= 1000;
+    auto now = std::chrono::steady_clock::now();
+    milliseconds = std::chrono::duration<double, std::milli>(now - mStart).count();
     mStart = now;
 #endif
 
@@ -65,3 +64,9 @@ double StopWatch::stop()
 
     return milliseconds;
 }
+
+int64_t StopWatch::timestamp()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -1,24 +1,24 @@
 #pragma once
 
-#if defined(BOOST_WINDOWS)
-    #include <cstdint>
-#else
+#include <cstdint>
+
+#if !defined(BOOST_WINDOWS)
     #include <chrono>
 #endif
 
-/// Stop watch.
+/// Stop watch on the monotonic clock with nanosecond resolution.
 /// @ingroup ComponentGroup
 class StopWatch
 {
 
 private:
-// MSVC does not have a high_resolution_clock in chrono until VS2015
+// MSVC does not have a steady_clock in chrono until VS2015
 #if defined(BOOST_WINDOWS)
     /// First time point.
     int64_t mStart;
 #else
     /// First time point.
-    std::chrono::high_resolution_clock::time_point mStart;
+    std::chrono::steady_clock::time_point mStart;
 #endif
 
 public:
@@ -36,4 +36,8 @@ public:
     /// Restarts timer and returns time until now.
     /// @return Time in milliseconds.
     double restart();
+
+    /// Monotonic timestamp for latency stamps.
+    /// @return Nanoseconds since an unspecified epoch.
+    static int64_t timestamp();
 };
@@ -0,0 +1,165 @@
+#include "Telemetry.hpp"
+
+#include "Logger.hpp"
+#include "MotorController.hpp"
+#include "RigRegistry.hpp"
+
+#include <chrono>
+
+namespace {
+
+/// Append a signed value as zigzag LEB128 varint, small magnitudes take one byte.
+void writeVarint(std::string &out, int value) {
+    uint32_t zigzag = (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+
+    while (zigzag >= 0x80) {
+        out.push_back(static_cast<char>((zigzag & 0x7F) | 0x80));
+        zigzag >>= 7;
+    }
+
+    out.push_back(static_cast<char>(zigzag));
+}
+
+}
+
+TelemetryPublisher::TelemetryPublisher(const RigRegistry &rigs, Sink sink, unsigned rateHz)
+        : m_Rigs(rigs), m_Sink(std::move(sink)), m_PoolIndex(0), m_KeyframeInterval(rateHz),
+          m_SinceKeyframe(0), m_Keyframe(true), m_Skipped(0),
+          m_Running(false) {
+    m_Baselines.resize(rigs.size());
+    for (auto &baseline : m_Baselines) {
+        baseline.last.fill(0);
+        baseline.keyframe = true;
+    }
+
+    if (rateHz == 0 || !m_Sink) {
+        return;
+    }
+
+    // all frame memory is reserved up front so steady state publishing never allocates
+    size_t poolSize = PoolSizePerRig * rigs.size();
+    m_Pool.reserve(poolSize);
+    for (size_t i = 0; i < poolSize; i++) {
+        auto frame = std::make_shared<std::string>();
+        frame->reserve(MaxFrameSize);
+        m_Pool.push_back(frame);
+    }
+
+    m_Running = true;
+
+    auto period = std::chrono::microseconds(1000000 / rateHz);
+
+    m_Thread = std::thread([this, period]() {
+        auto next = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        while (m_Running) {
+            next += period;
+            m_stop.wait_until(lock, next, [this]() { return !m_Running; });
+
+            if (!m_Running) {
+                break;
+            }
+
+            try {
+                publish();
+            }
+            catch (std::exception &ex) {
+                Logger::error("Failed to publish telemetry, error '%s'.", ex.what());
+            }
+        }
+    });
+}
+
+TelemetryPublisher::~TelemetryPublisher() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_Running = false;
+    }
+    m_stop.notify_one();
+
+    if (m_Thread.joinable()) {
+        m_Thread.join();
+    }
+}
+
+void TelemetryPublisher::requestKeyframe() {
+    m_Keyframe = true;
+}
+
+std::shared_ptr<std::string> TelemetryPublisher::acquireFrame() {
+    for (size_t i = 0; i < m_Pool.size(); i++) {
+        auto &frame = m_Pool[(m_PoolIndex + i) % m_Pool.size()];
+
+        if (frame.use_count() == 1) {
+            m_PoolIndex = (m_PoolIndex + i + 1) % m_Pool.size();
+            return frame;
+        }
+    }
+
+    return nullptr;
+}
+
+void TelemetryPublisher::publish() {
+    if (m_Keyframe.exchange(false) || ++m_SinceKeyframe >= m_KeyframeInterval) {
+        m_SinceKeyframe = 0;
+        for (auto &baseline : m_Baselines) {
+            baseline.keyframe = true;
+        }
+    }
+
+    for (unsigned id = 0; id < m_Baselines.size(); id++) {
+        publishRig(id);
+    }
+}
+
+void TelemetryPublisher::publishRig(unsigned id) {
+    Baseline &baseline = m_Baselines[id];
+    RigState state = m_Rigs.get(id)->getState();
+
+    std::array<int, FieldCount> fields = {
+            state.pitchPosition,
+            state.yawPosition,
+            state.pitchVector,
+            state.yawVector,
+            state.focus,
+            state.zoom,
+            state.irCut ? 1 : 0,
+            state.busy ? 1 : 0
+    };
+
+    uint8_t mask = 0;
+
+    for (size_t i = 0; i < FieldCount; i++) {
+        if (baseline.keyframe || fields[i] != baseline.last[i]) {
+            mask |= 1u << i;
+        }
+    }
+
+    if (mask == 0) {
+        return;
+    }
+
+    auto frame = acquireFrame();
+
+    if (!frame) {
+        // keep the old baseline so the same changes go out with the next frame
+        m_Skipped++;
+        return;
+    }
+
+    frame->clear();
+    frame->push_back('T');
+    writeVarint(*frame, static_cast<int>(id));
+    frame->push_back(static_cast<char>(mask));
+
+    for (size_t i = 0; i < FieldCount; i++) {
+        if (mask & (1u << i)) {
+            writeVarint(*frame, fields[i]);
+        }
+    }
+
+    baseline.last = fields;
+    baseline.keyframe = false;
+    m_Sink(frame);
+}
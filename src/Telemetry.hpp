@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class RigRegistry;
+
+/// Samples the state of every rig at a fixed rate and publishes only the fields that changed since the last frame.
+///
+/// Frame layout (binary message, one per rig):
+///   byte 0    'T'
+///   byte 1..  rig id as zigzag LEB128 varint, one byte below 64
+///   next      field mask, bit n is set if field n follows
+///   rest      one zigzag LEB128 varint per present field, in field order
+/// Fields: 0 pitch position, 1 yaw position, 2 pitch vector, 3 yaw vector,
+///         4 focus, 5 zoom, 6 ir cut, 7 lens busy.
+/// A frame without changes is not sent. The first frame, every frame after requestKeyframe() and one frame
+/// per second, changed or not, carry all fields, so a receiver recovers from deltas dropped by a full send queue.
+class TelemetryPublisher {
+public:
+    /// Receives each encoded frame. The frame buffer is reused once the sink drops its reference.
+    typedef std::function<void(std::shared_ptr<const std::string>)> Sink;
+
+    /// @param rateHz Samples per second, zero disables the publisher.
+    TelemetryPublisher(const RigRegistry &rigs, Sink sink, unsigned rateHz);
+
+    ~TelemetryPublisher();
+
+    /// Send all fields with the next frame, e.g. after a reconnect.
+    void requestKeyframe();
+
+    /// Frames skipped because every pooled buffer was still in flight.
+    uint64_t getSkippedFrames() const {
+        return m_Skipped;
+    }
+
+private:
+    static constexpr size_t FieldCount = 8;
+    static constexpr size_t PoolSizePerRig = 8;
+    /// Tag, rig id, mask and up to five varint bytes per field.
+    static constexpr size_t MaxFrameSize = 2 + 5 + FieldCount * 5;
+
+    /// Field values of the last frame sent for a rig.
+    struct Baseline {
+        std::array<int, FieldCount> last;
+        /// Send all fields with the next frame of this rig.
+        bool keyframe;
+    };
+
+    /// Sample, diff and send one frame per rig.
+    void publish();
+
+    void publishRig(unsigned id);
+
+    /// Pooled buffer no longer referenced by the sink, or nullptr.
+    std::shared_ptr<std::string> acquireFrame();
+
+    const RigRegistry &m_Rigs;
+    Sink m_Sink;
+
+    /// Preallocated frame buffers, a buffer is free while the pool holds the only reference.
+    std::vector<std::shared_ptr<std::string>> m_Pool;
+    size_t m_PoolIndex;
+
+    /// Samples between periodic keyframes and samples taken since the last one.
+    unsigned m_KeyframeInterval;
+    unsigned m_SinceKeyframe;
+
+    std::vector<Baseline> m_Baselines;
+    std::atomic<bool> m_Keyframe;
+    std::atomic<uint64_t> m_Skipped;
+
+    std::atomic<bool> m_Running;
+    std::mutex m_mutex;
+    std::condition_variable m_stop;
+    std::thread m_Thread;
+};
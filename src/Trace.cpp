@@ -0,0 +1,217 @@
+#include "Trace.hpp"
+
+#include "StopWatch.hpp"
+
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+/// Spans kept per thread, 32 bytes each.
+constexpr size_t RingSize = 64 * 1024;
+
+struct Event {
+    const char *name;
+    const char *category;
+    int64_t start;
+    int64_t duration;
+};
+
+/// Spans of one thread. Outlives the thread, so its spans can still be exported after it ended, and is handed on to
+/// the next thread that starts recording, so short lived threads do not cost a ring each.
+struct ThreadBuffer {
+    explicit ThreadBuffer(unsigned id) : id(id), next(0), wrapped(false) {
+    }
+
+    std::mutex mutex;
+    const unsigned id;
+    std::string name;
+    /// Allocated by the first span, so naming a thread costs nothing while tracing is off.
+    std::vector<Event> events;
+    size_t next;
+    bool wrapped;
+};
+
+std::atomic<bool> enabled(false);
+
+/// Every buffer ever handed out and the ones whose thread ended. Never destroyed, detached threads may still end
+/// while the process exits.
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    std::vector<ThreadBuffer *> released;
+};
+
+Registry &registry() {
+    static Registry *instance = new Registry();
+    return *instance;
+}
+
+/// Returns the buffer of the calling thread to the registry when the thread ends.
+struct BufferOwner {
+    ThreadBuffer *buffer = nullptr;
+
+    ~BufferOwner() {
+        if (buffer) {
+            std::lock_guard<std::mutex> lock(registry().mutex);
+            registry().released.push_back(buffer);
+        }
+    }
+};
+
+ThreadBuffer &threadBuffer() {
+    // the registry keeps the buffer alive, a plain pointer avoids a guarded thread_local on every span
+    thread_local ThreadBuffer *buffer = nullptr;
+
+    if (!buffer) {
+        thread_local BufferOwner owner;
+        Registry &all = registry();
+        std::lock_guard<std::mutex> lock(all.mutex);
+
+        if (!all.released.empty()) {
+            // the spans of the ended thread stay in the ring until they are overwritten, only its name goes
+            buffer = all.released.back();
+            all.released.pop_back();
+            std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+            buffer->name.clear();
+        } else {
+            all.buffers.push_back(std::make_shared<ThreadBuffer>(static_cast<unsigned>(all.buffers.size() + 1)));
+            buffer = all.buffers.back().get();
+        }
+        owner.buffer = buffer;
+    }
+    return *buffer;
+}
+
+void writeString(std::ostream &out, const std::string &text) {
+    out << '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out << ' ';
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+/// Nanoseconds as microseconds with three decimals, the unit of the trace-event format.
+void writeMicros(std::ostream &out, int64_t nanoseconds) {
+    char text[32];
+    snprintf(text, sizeof(text), "%" PRId64 ".%03" PRId64, nanoseconds / 1000, nanoseconds % 1000);
+    out << text;
+}
+
+}
+
+Trace::Span::Span(const char *name, const char *category)
+        : m_Name(name), m_Category(category), m_Start(isEnabled() ? StopWatch::timestamp() : 0) {
+}
+
+Trace::Span::~Span() {
+    if (m_Start == 0) {
+        return;
+    }
+
+    int64_t end = StopWatch::timestamp();
+    ThreadBuffer &buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+
+    if (buffer.events.empty()) {
+        buffer.events.resize(RingSize);
+    }
+
+    buffer.events[buffer.next] = Event{m_Name, m_Category, m_Start, end - m_Start};
+
+    if (++buffer.next == RingSize) {
+        buffer.next = 0;
+        buffer.wrapped = true;
+    }
+}
+
+void Trace::setEnabled(bool on) {
+    enabled.store(on, std::memory_order_relaxed);
+}
+
+bool Trace::isEnabled() {
+    return enabled.load(std::memory_order_relaxed);
+}
+
+void Trace::setThreadName(const std::string &name) {
+    ThreadBuffer &buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.name = name;
+}
+
+void Trace::writeChromeJson(std::ostream &out) {
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        buffers = registry().buffers;
+    }
+
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+
+    for (auto &buffer : buffers) {
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+
+        if (!buffer->name.empty()) {
+            out << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id
+                << ",\"args\":{\"name\":";
+            writeString(out, buffer->name);
+            out << "}}";
+            first = false;
+        }
+
+        // oldest first, the viewer copes with any order but diffs of two exports stay readable
+        size_t count = buffer->wrapped ? RingSize : buffer->next;
+        size_t begin = buffer->wrapped ? buffer->next : 0;
+
+        for (size_t i = 0; i < count; i++) {
+            const Event &event = buffer->events[(begin + i) % RingSize];
+
+            out << (first ? "\n" : ",\n") << "{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category
+                << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->id << ",\"ts\":";
+            writeMicros(out, event.start);
+            out << ",\"dur\":";
+            writeMicros(out, event.duration);
+            out << "}";
+            first = false;
+        }
+    }
+
+    out << "\n]}\n";
+}
+
+void Trace::save(const std::string &path) {
+    std::ofstream out(path);
+
+    if (!out) {
+        throw std::runtime_error("Cannot write trace '" + path + "'");
+    }
+
+    writeChromeJson(out);
+
+    if (!out) {
+        throw std::runtime_error("Failed writing trace '" + path + "'");
+    }
+}
+
+void Trace::clear() {
+    std::lock_guard<std::mutex> registryLock(registry().mutex);
+
+    for (auto &buffer : registry().buffers) {
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+        buffer->next = 0;
+        buffer->wrapped = false;
+    }
+}
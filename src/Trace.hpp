@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/// Scoped timing spans for finding out where time goes on a loaded rig.
+///
+/// Every thread records its spans into a ring of its own, so a span costs two clock reads and a store under a lock
+/// that only the exporter ever contends. When a ring is full the oldest spans of that thread are overwritten. The ring
+/// of a thread that ended goes to the next thread that records, e.g. the next std::async of a preset recall.
+/// Tracing is off until enabled, a span on a disabled tracer costs one relaxed load.
+///
+/// The recorded spans are exported as Chrome trace-event JSON, open it in chrome://tracing or ui.perfetto.dev.
+class Trace {
+public:
+    /// Times its own lifetime.
+    class Span {
+    public:
+        /// @param name Static string, only the pointer is kept.
+        /// @param category Static string to group spans by in the viewer.
+        explicit Span(const char *name, const char *category = "rig");
+
+        ~Span();
+
+        Span(const Span &) = delete;
+        Span &operator=(const Span &) = delete;
+
+    private:
+        const char *m_Name;
+        const char *m_Category;
+        /// Start stamp, 0 if tracing was off when the span opened.
+        int64_t m_Start;
+    };
+
+    static void setEnabled(bool enabled);
+
+    static bool isEnabled();
+
+    /// Label the calling thread in the exported trace.
+    static void setThreadName(const std::string &name);
+
+    /// Write the spans of all threads as Chrome trace-event JSON.
+    static void writeChromeJson(std::ostream &out);
+
+    /// Write the trace to a file, throws std::runtime_error if it cannot be written.
+    static void save(const std::string &path);
+
+    /// Forget all recorded spans.
+    static void clear();
+};
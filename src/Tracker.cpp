@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <cmath>
+#include "Tracker.hpp"
+#include "Focuser.hpp"
+#include "Logger.hpp"
+#include "StepperMotor.hpp"
+#include "Trace.hpp"
+
+// output angle of one half step, 5.625 degrees of the rotor through the 1:63.68 gearbox
+static const double DegreesPerHalfStep = 5.625 / 63.68395;
+// weight of a new report in the subject rate estimate, frame jitter makes single differences noisy
+static const double RateSmoothing = 0.3;
+static const double Pi = 3.14159265358979323846;
+
+Tracker::Config Tracker::defaults()
+{
+    Config config;
+    config.pitch = {2.0, 0.5, 0.05, 0.8};
+    config.yaw = config.pitch;
+    config.fieldOfView = 60.0;
+    config.zoomRatio = 3.0;
+    config.period = std::chrono::milliseconds(10);
+    config.timeout = std::chrono::milliseconds(500);
+    return config;
+}
+
+Tracker::Tracker(std::shared_ptr<StepperMotor> pitch, std::shared_ptr<StepperMotor> yaw,
+                 std::shared_ptr<Focuser> focuser, const Config& config)
+    : m_Focuser(std::move(focuser)), m_Config(config), m_Pitch(), m_Yaw(), m_Stopping(false), m_Tracking(false)
+{
+    m_Pitch.motor = std::move(pitch);
+    m_Pitch.gains = config.pitch;
+    m_Yaw.motor = std::move(yaw);
+    m_Yaw.gains = config.yaw;
+}
+
+Tracker::~Tracker()
+{
+    stop();
+}
+
+void Tracker::update(double x, double y)
+{
+    double pitchError = toDegrees(y);
+    double yawError = toDegrees(x);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto now = std::chrono::steady_clock::now();
+    double interval = std::chrono::duration<double>(now - m_LastReport).count();
+
+    if(!m_Tracking)
+    {
+        // a loop that timed out has released the lock for good, it only stops the axes on its way out
+        if(m_Thread.joinable())
+        {
+            m_Thread.join();
+        }
+
+        for(Axis* axis : {&m_Pitch, &m_Yaw})
+        {
+            axis->subjectRate = 0;
+            axis->hasSubject = false;
+            axis->integral = 0;
+            axis->lastError = 0;
+            axis->fresh = true;
+        }
+
+        m_Stopping = false;
+        m_Tracking = true;
+        m_Thread = std::thread([this]()
+        {
+            Trace::setThreadName("tracker");
+            loop();
+        });
+    }
+
+    report(m_Pitch, pitchError, interval);
+    report(m_Yaw, yawError, interval);
+    m_LastReport = now;
+}
+
+void Tracker::stop()
+{
+    std::thread thread;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_Stopping = true;
+        thread = std::move(m_Thread);
+    }
+    m_stop.notify_all();
+
+    if(thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+double Tracker::toDegrees(double offset) const
+{
+    // the focal length grows linearly with the zoom value, the half width shrinks with it
+    double focal = 1.0 + (m_Config.zoomRatio - 1.0) * m_Focuser->getZoom() / Focuser::MaxZoom;
+    double halfWidth = std::tan(m_Config.fieldOfView * Pi / 360.0) / focal;
+    return std::atan(offset * halfWidth) * 180.0 / Pi;
+}
+
+void Tracker::report(Axis& axis, double error, double interval)
+{
+    int position = axis.motor->getStepPosition();
+    double subject = position * DegreesPerHalfStep + error;
+
+    if(axis.hasSubject && interval > 0)
+    {
+        double rate = (subject - axis.subject) / interval;
+        axis.subjectRate += RateSmoothing * (rate - axis.subjectRate);
+    }
+
+    axis.subject = subject;
+    axis.hasSubject = true;
+    axis.reported = error;
+    axis.reportPosition = position;
+}
+
+// half steps per second the motor runs at vector, 0 at vector 0
+static double halfStepRate(StepperMotor& motor, int vector)
+{
+    auto period = motor.period(vector).count();
+    return period > 0 ? 1e6 / period : 0.0;
+}
+
+// Vector whose actual rate comes nearest to rate in degrees per second. Resonance bands move some rates of the axis
+// to a band edge, so the linear law of the vector alone can run the axis far off the rate the loop asked for.
+static int vectorForRate(StepperMotor& motor, double rate)
+{
+    double wanted = std::abs(rate) / DegreesPerHalfStep;
+
+    // the rate never falls as the vector grows, find the first one that reaches the wanted rate
+    int low = 0;
+    int high = 100;
+    while(low < high)
+    {
+        int middle = (low + high) / 2;
+        if(halfStepRate(motor, middle) < wanted)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    if(low > 0 && wanted - halfStepRate(motor, low - 1) < halfStepRate(motor, low) - wanted)
+        low--;
+    return rate < 0 ? -low : low;
+}
+
+void Tracker::control(Axis& axis, double dt, double sinceReport)
+{
+    // between frames the error is predicted from how far the head and the subject moved since the report
+    double moved = (axis.motor->getStepPosition() - axis.reportPosition) * DegreesPerHalfStep;
+    double error = axis.reported - moved + axis.subjectRate * sinceReport;
+
+    double derivative = axis.fresh ? 0 : (error - axis.lastError) / dt;
+    axis.fresh = false;
+    axis.lastError = error;
+
+    const Gains& gains = axis.gains;
+    double rate = gains.kp * error + gains.ki * axis.integral + gains.kd * derivative + gains.kff * axis.subjectRate;
+    double fullRate = halfStepRate(*axis.motor, 100) * DegreesPerHalfStep;
+
+    // no windup while the axis runs flat out, unless the error pulls it back
+    if(std::abs(rate) < fullRate || (error > 0) != (rate > 0))
+    {
+        axis.integral += error * dt;
+    }
+
+    axis.motor->run_async(vectorForRate(*axis.motor, rate));
+}
+
+void Tracker::loop()
+{
+    const double dt = std::chrono::duration<double>(m_Config.period).count();
+    auto next = std::chrono::steady_clock::now();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while(true)
+    {
+        next += m_Config.period;
+        if(m_stop.wait_until(lock, next, [this]()
+        {
+            return m_Stopping;
+        }))
+        {
+            break;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if(now - m_LastReport > m_Config.timeout)
+        {
+            Logger::info("Tracking lost the subject, stopping");
+            break;
+        }
+
+        Trace::Span span("track pass", "motion");
+        double sinceReport = std::chrono::duration<double>(now - m_LastReport).count();
+        control(m_Pitch, dt, sinceReport);
+        control(m_Yaw, dt, sinceReport);
+
+        // keep the rate, but do not rush through passes the thread was late for
+        if(now - next > m_Config.period)
+        {
+            next = now;
+        }
+    }
+
+    m_Tracking = false;
+    lock.unlock();
+
+    m_Pitch.motor->run_async(0);
+    m_Yaw.motor->run_async(0);
+}
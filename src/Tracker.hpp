@@ -0,0 +1,97 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+class StepperMotor;
+class Focuser;
+
+// Visual servo of one head. A vision process reports where the subject sits in the frame at its own frame rate,
+// a loop at a fixed rate turns the latest report into pitch and yaw velocities. Axis commands neither wait for
+// frames nor bunch up behind network jitter, and a report takes effect within one loop period.
+//
+// Offsets are turned into angles through the field of view at the current zoom, so the pixel gains scale with
+// the zoom: at full tele a pixel is a fraction of the angle it is at wide angle. The PID works in degrees and
+// degrees per second and the same gains hold at every zoom.
+class Tracker
+{
+public:
+    struct Gains
+    {
+        double kp;      // deg/s per degree of error
+        double ki;      // deg/s per degree second of error
+        double kd;      // deg/s per deg/s of error change
+        double kff;     // share of the estimated subject rate fed forward, 1 follows a steady subject without lag
+    };
+
+    struct Config
+    {
+        Gains pitch;
+        Gains yaw;
+        double fieldOfView;                 // horizontal degrees at the widest zoom
+        double zoomRatio;                   // focal length at the longest zoom over the widest
+        std::chrono::microseconds period;   // control loop period
+        std::chrono::milliseconds timeout;  // stop once no offset arrived for this long
+    };
+
+    // 100 Hz loop, 0.5 s subject timeout, gains for the 28BYJ-48 at 5 ms per half step
+    static Config defaults();
+
+    Tracker(std::shared_ptr<StepperMotor> pitch, std::shared_ptr<StepperMotor> yaw, std::shared_ptr<Focuser> focuser,
+            const Config& config);
+    ~Tracker();
+
+    // Subject offset from the frame centre in units of half the frame width, x towards positive yaw and
+    // y towards positive pitch. Starts the loop if it is not running.
+    void update(double x, double y);
+
+    // End tracking and stop both axes
+    void stop();
+
+    // True while the loop drives the axes
+    bool isTracking() const
+    {
+        return m_Tracking;
+    }
+private:
+    // Controller state of one axis, owned by the loop thread except for the report fields
+    struct Axis
+    {
+        std::shared_ptr<StepperMotor> motor;
+        Gains gains;
+
+        // latest report: error in degrees and the axis position it was measured at
+        double reported;
+        int reportPosition;
+        // subject direction relative to the power-on position of the last report, and its rate
+        double subject;
+        double subjectRate;
+        bool hasSubject;
+
+        double integral;
+        double lastError;
+        bool fresh;                         // no loop pass since tracking started
+    };
+
+    void loop();
+    void control(Axis& axis, double dt, double sinceReport);
+    void report(Axis& axis, double error, double interval);
+    // degrees of an offset at the current zoom
+    double toDegrees(double offset) const;
+
+    std::shared_ptr<Focuser> m_Focuser;
+    Config m_Config;
+
+    // guards the axes reports and the loop start and stop
+    std::mutex m_mutex;
+    std::condition_variable m_stop;
+    Axis m_Pitch;
+    Axis m_Yaw;
+    std::chrono::steady_clock::time_point m_LastReport;
+    bool m_Stopping;
+    std::atomic<bool> m_Tracking;
+    std::thread m_Thread;
+};
@@ -0,0 +1,100 @@
+#include "UdpControl.hpp"
+
+#include "LatencyMonitor.hpp"
+#include "Logger.hpp"
+#include "Trace.hpp"
+
+#include <future>
+
+constexpr std::chrono::milliseconds UdpControl::SequenceTimeout;
+
+UdpControl::UdpControl(boost::asio::io_service &io, const std::string &address, uint16_t port)
+        : m_Io(io), m_Socket(io), m_HaveSequence(false), m_LastSequence(0), m_Accepted(0), m_Late(0),
+          m_Malformed(0) {
+    boost::asio::ip::udp::endpoint endpoint(boost::asio::ip::address::from_string(address), port);
+
+    m_Socket.open(endpoint.protocol());
+    m_Socket.set_option(boost::asio::ip::udp::socket::reuse_address(true));
+    m_Socket.bind(endpoint);
+
+    m_Io.post([this]() {
+        receive();
+    });
+}
+
+UdpControl::~UdpControl() {
+    if (m_Io.stopped()) {
+        // nobody else touches the socket anymore
+        boost::system::error_code ec;
+        m_Socket.close(ec);
+        return;
+    }
+
+    // the socket belongs to the io thread, close it there and wait
+    std::promise<void> closed;
+
+    m_Io.post([this, &closed]() {
+        boost::system::error_code ec;
+        m_Socket.close(ec);
+        closed.set_value();
+    });
+
+    closed.get_future().wait();
+}
+
+void UdpControl::receive() {
+    m_Socket.async_receive_from(boost::asio::buffer(m_Buffer), m_Sender,
+                                [this](const boost::system::error_code &ec, size_t size) {
+        // aborted means the socket was closed, this may already be gone
+        if (ec == boost::asio::error::operation_aborted) {
+            return;
+        }
+
+        if (!ec) {
+            onDatagram(size);
+        }
+
+        receive();
+    });
+}
+
+void UdpControl::onDatagram(size_t size) {
+    LatencyMonitor::CommandScope command;
+    Trace::Span span("udp receive", "net");
+
+    if ((size != DatagramSize && size != RigDatagramSize) || m_Buffer[0] != 'J') {
+        m_Malformed++;
+        return;
+    }
+
+    uint32_t sequence = (uint32_t(m_Buffer[1]) << 24) | (uint32_t(m_Buffer[2]) << 16) |
+                        (uint32_t(m_Buffer[3]) << 8) | uint32_t(m_Buffer[4]);
+
+    auto now = std::chrono::steady_clock::now();
+
+    // a new sender or a long pause starts a new stream, otherwise only newer datagrams count (wrap safe)
+    bool newStream = !m_HaveSequence || m_Sender != m_LastSender || now - m_LastAccepted > SequenceTimeout;
+
+    if (!newStream && static_cast<int32_t>(sequence - m_LastSequence) <= 0) {
+        m_Late++;
+        return;
+    }
+
+    m_HaveSequence = true;
+    m_LastSequence = sequence;
+    m_LastSender = m_Sender;
+    m_LastAccepted = now;
+    m_Accepted++;
+
+    int pitch = static_cast<int8_t>(m_Buffer[5]);
+    int yaw = static_cast<int8_t>(m_Buffer[6]);
+    unsigned rig = size == RigDatagramSize ? m_Buffer[7] : 0;
+    LatencyMonitor::instance().mark(LatencyMonitor::Parse);
+
+    try {
+        onVelocity(rig, pitch, yaw);
+    }
+    catch (std::exception &ex) {
+        Logger::error("Failed during onVelocity, error '%s'.", ex.what());
+    }
+}
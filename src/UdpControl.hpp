@@ -0,0 +1,70 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <boost/signals2/signal.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/// Optional low-latency velocity channel for joystick streams.
+/// Runs on an existing io_context so it shares the websocket thread.
+///
+/// Datagram layout (7 or 8 bytes):
+///   byte 0     'J'
+///   byte 1..4  sequence number, big endian, incremented by the sender per datagram
+///   byte 5     pitch vector, int8 [-100,100]
+///   byte 6     yaw vector, int8 [-100,100]
+///   byte 7     rig id, optional, rig 0 if missing
+/// Datagrams older than the newest accepted one are dropped, a lost datagram is simply superseded.
+class UdpControl {
+public:
+    /// Start listening on address:port.
+    UdpControl(boost::asio::io_service &io, const std::string &address, uint16_t port);
+
+    ~UdpControl();
+
+    /// A fresh velocity datagram arrived, rig id, pitch and yaw vector are passed. Called on the io thread.
+    boost::signals2::signal<void(unsigned, int, int)> onVelocity;
+
+    uint64_t getAccepted() const {
+        return m_Accepted;
+    }
+
+    /// Datagrams dropped for arriving after a newer one.
+    uint64_t getLate() const {
+        return m_Late;
+    }
+
+    uint64_t getMalformed() const {
+        return m_Malformed;
+    }
+
+private:
+    static constexpr size_t DatagramSize = 7;
+    static constexpr size_t RigDatagramSize = 8;
+
+    /// A sender silent this long starts a new sequence, e.g. after a restart.
+    static constexpr std::chrono::milliseconds SequenceTimeout{1000};
+
+    void receive();
+
+    void onDatagram(size_t size);
+
+    boost::asio::io_service &m_Io;
+    boost::asio::ip::udp::socket m_Socket;
+    boost::asio::ip::udp::endpoint m_Sender;
+    std::array<uint8_t, 64> m_Buffer;
+
+    /// Sequence state of the current stream, only used on the io thread.
+    bool m_HaveSequence;
+    uint32_t m_LastSequence;
+    boost::asio::ip::udp::endpoint m_LastSender;
+    std::chrono::steady_clock::time_point m_LastAccepted;
+
+    std::atomic<uint64_t> m_Accepted;
+    std::atomic<uint64_t> m_Late;
+    std::atomic<uint64_t> m_Malformed;
+};
@@ -0,0 +1,57 @@
+#include "Watchdog.hpp"
+
+#include "Logger.hpp"
+
+#include <algorithm>
+
+Watchdog::Watchdog(std::chrono::milliseconds timeout, std::function<void()> onExpired)
+        : m_Timeout(timeout), m_OnExpired(std::move(onExpired)), m_LastFeed(0), m_Armed(false), m_Running(false) {
+    if (m_Timeout.count() <= 0 || !m_OnExpired) {
+        return;
+    }
+
+    m_Running = true;
+
+    // check a few times per timeout so the stop latency stays close to the configured value
+    auto period = std::max(m_Timeout / 4, std::chrono::milliseconds(1));
+
+    m_Thread = std::thread([this, period]() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        while (m_Running) {
+            m_stop.wait_for(lock, period, [this]() { return !m_Running; });
+
+            if (!m_Running || !m_Armed) {
+                continue;
+            }
+
+            auto last = Clock::time_point(Clock::duration(m_LastFeed.load()));
+
+            if (Clock::now() - last > m_Timeout && m_Armed.exchange(false)) {
+                try {
+                    m_OnExpired();
+                }
+                catch (std::exception &ex) {
+                    Logger::error("Failed during watchdog expiry, error '%s'.", ex.what());
+                }
+            }
+        }
+    });
+}
+
+Watchdog::~Watchdog() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_Running = false;
+    }
+    m_stop.notify_one();
+
+    if (m_Thread.joinable()) {
+        m_Thread.join();
+    }
+}
+
+void Watchdog::feed() {
+    m_LastFeed = Clock::now().time_since_epoch().count();
+    m_Armed = true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/// Dead-man switch that fires a callback once when it has not been fed for a given timeout.
+/// After firing it stays quiet until it is fed again.
+class Watchdog {
+public:
+    /// @param timeout Time without feed() until onExpired is called. Zero disables the watchdog.
+    /// @param onExpired Called from the watchdog thread.
+    Watchdog(std::chrono::milliseconds timeout, std::function<void()> onExpired);
+
+    ~Watchdog();
+
+    /// Signal that the guarded activity is still alive.
+    void feed();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    std::chrono::milliseconds m_Timeout;
+    std::function<void()> m_OnExpired;
+
+    /// Time of the last feed in steady clock ticks.
+    std::atomic<Clock::rep> m_LastFeed;
+    /// True while fed and not yet expired.
+    std::atomic<bool> m_Armed;
+
+    std::atomic<bool> m_Running;
+    std::mutex m_mutex;
+    std::condition_variable m_stop;
+    std::thread m_Thread;
+};
@@ -6,26 +6,682 @@
 #include "MotorController.hpp"
 
 //#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
 #include <atomic>
 #include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <future>
 #include <iomanip>
+#include <sstream>
 #include <signal.h>
 #include "Client.hpp"
+#include "Clock.hpp"
+#include "CommandLog.hpp"
+#include "CommandRouter.hpp"
+#include "ControlArbiter.hpp"
+#include "LatencyMonitor.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "RigRegistry.hpp"
+#include "Server.hpp"
+#include "SharedControl.hpp"
+#include "StepEngine.hpp"
+#include "Telemetry.hpp"
+#include "Trace.hpp"
+#include "UdpControl.hpp"
+#include "Watchdog.hpp"
 
 using namespace std;
+namespace po = boost::program_options;
 
 std::atomic<bool> running(true);
+std::atomic<bool> dumpLatency(false);
 
 static void on_close(int signal) {
-    std::cerr << "Stopping\n";
     running = false;
 }
 
+static void on_dump(int signal) {
+    dumpLatency = true;
+}
+
+// loop until shutdown, dump latency statistics on SIGUSR1
+static void waitForShutdown()
+{
+    while(running)
+    {
+        if(dumpLatency.exchange(false))
+        {
+            const std::string report = LatencyMonitor::instance().report();
+            // the report ends with a newline, the logger adds its own
+            Logger::info("Latency report\n%.*s", static_cast<int>(report.size()) - 1, report.c_str());
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    Logger::info("Stopping");
+}
+
+// visual servo settings shared by all heads
+static Tracker::Config trackingConfig(const po::variables_map& vm)
+{
+    Tracker::Config config = Tracker::defaults();
+
+    std::istringstream gains(vm["track-gains"].as<std::string>());
+    char comma1, comma2, comma3;
+    Tracker::Gains& g = config.pitch;
+    if(!(gains >> g.kp >> comma1 >> g.ki >> comma2 >> g.kd >> comma3 >> g.kff) || comma1 != ',' || comma2 != ',' ||
+       comma3 != ',' || !(gains >> std::ws).eof())
+        throw std::invalid_argument("--track-gains must look like KP,KI,KD,KFF");
+    config.yaw = config.pitch;
+
+    unsigned rate = vm["track-rate"].as<unsigned>();
+    if(rate == 0 || rate > 1000)
+        throw std::invalid_argument("--track-rate must be 1 to 1000");
+
+    config.fieldOfView = vm["field-of-view"].as<double>();
+    config.zoomRatio = vm["zoom-ratio"].as<double>();
+    // a millisecond period would round e.g. 300 Hz up to 333 Hz
+    config.period = std::chrono::microseconds(1000000 / rate);
+    return config;
+}
+
+// operator velocity response "DEADBAND,GAMMA,MAXRATE" of one axis, the same for all heads
+static ResponseCurve::Shape responseShape(const po::variables_map& vm, const std::string& option)
+{
+    ResponseCurve::Shape shape;
+    std::istringstream in(vm[option].as<std::string>());
+    char comma1, comma2;
+    if(!(in >> shape.deadband >> comma1 >> shape.gamma >> comma2 >> shape.maxRate) || comma1 != ',' ||
+       comma2 != ',' || !(in >> std::ws).eof())
+        throw std::invalid_argument("--" + option + " must look like DEADBAND,GAMMA,MAXRATE");
+
+    // reject a bad shape before any head is built
+    ResponseCurve::validate(shape);
+    return shape;
+}
+
+// step rates "LOW-HIGH[,LOW-HIGH...]" one axis must not cruise at, the same for all heads
+static std::vector<ResponseCurve::Band> resonanceBands(const po::variables_map& vm, const std::string& option,
+                                                       const ResponseCurve::Shape& response)
+{
+    std::vector<ResponseCurve::Band> bands;
+    std::istringstream in(vm[option].as<std::string>());
+    std::string item;
+
+    while(std::getline(in, item, ','))
+    {
+        std::istringstream range(item);
+        ResponseCurve::Band band;
+        char dash;
+        if(!(range >> band.low >> dash >> band.high) || dash != '-' || !(range >> std::ws).eof())
+            throw std::invalid_argument("--" + option + " must look like LOW-HIGH[,LOW-HIGH...]");
+        bands.push_back(band);
+    }
+
+    // check against both responses of the axis to reject bands that leave it no rate before any head is built
+    ResponseCurve::validate(ResponseCurve::linear(), bands);
+    ResponseCurve::validate(response, bands);
+    return bands;
+}
+
+// controller peers "HOST[:PORT]" in order of preference, an IPv6 address with a port goes in brackets
+static std::vector<WebSocketClient::Endpoint> controllerEndpoints(const po::variables_map& vm)
+{
+    const uint16_t defaultPort = vm["port"].as<uint16_t>();
+    std::vector<std::string> hosts;
+    if(vm.count("host"))
+        hosts = vm["host"].as<std::vector<std::string>>();
+    if(hosts.empty())
+        hosts.push_back("192.168.1.99");
+
+    std::vector<WebSocketClient::Endpoint> endpoints;
+
+    for(const std::string& host : hosts)
+    {
+        WebSocketClient::Endpoint endpoint{host, defaultPort};
+        std::string::size_type colon = host.rfind(':');
+
+        // a bare IPv6 address has colons but no port
+        if(!host.empty() && host[0] == '[')
+        {
+            std::string::size_type close = host.find(']');
+            if(close == std::string::npos || (close + 1 < host.size() && host[close + 1] != ':'))
+                throw std::invalid_argument("--host " + host + " must look like [ADDRESS]:PORT");
+            endpoint.address = host.substr(1, close - 1);
+            colon = close + 1 < host.size() ? close + 1 : std::string::npos;
+        }
+        else if(colon != std::string::npos && host.find(':') != colon)
+        {
+            colon = std::string::npos;
+        }
+        else if(colon != std::string::npos)
+        {
+            endpoint.address = host.substr(0, colon);
+        }
+
+        if(colon != std::string::npos)
+        {
+            const std::string port = host.substr(colon + 1);
+            char* end = nullptr;
+            unsigned long value = std::strtoul(port.c_str(), &end, 10);
+            if(port.empty() || *end != '\0' || value == 0 || value > 65535)
+                throw std::invalid_argument("--host " + host + " has an invalid port");
+            endpoint.port = static_cast<uint16_t>(value);
+        }
+
+        if(endpoint.address.empty())
+            throw std::invalid_argument("--host " + host + " has no address");
+        endpoints.push_back(endpoint);
+    }
+    return endpoints;
+}
+
+// optional shared memory channel for processes on the rig, feeds the same dispatch as the websocket
+static std::unique_ptr<SharedControl> startSharedControl(const po::variables_map& vm, RigRegistry& rigs,
+                                                         CommandRouter& router, Watchdog& deadman,
+                                                         CommandLog::Recorder* recorder)
+{
+    const std::string name = vm["shm-name"].as<std::string>();
+    if(name.empty())
+        return nullptr;
+
+    // nobody waits for answers on the ring, they go to the log
+    const CommandReply reply = [](const std::string& answer) {
+        Logger::warning("Local command answered %s", answer.c_str());
+    };
+
+    auto handler = [&router, &deadman, reply, recorder](const std::string& msg) {
+        if(msg.empty())
+            return;
+
+        deadman.feed();
+        if(recorder)
+            recorder->recordCommand(msg);
+        router.dispatch(msg, reply);
+    };
+
+    auto source = [&rigs](unsigned rig, SharedControl::State& state) {
+        MotorController* motors = rigs.get(rig);
+        if(!motors)
+            return false;
+
+        RigState current = motors->getState();
+        state.pitchPosition = current.pitchPosition;
+        state.yawPosition = current.yawPosition;
+        state.pitchVector = current.pitchVector;
+        state.yawVector = current.yawVector;
+        state.focus = current.focus;
+        state.zoom = current.zoom;
+        state.irCut = current.irCut;
+        state.busy = current.busy;
+        state.homed = motors->isHomed();
+        state.tracking = motors->isTracking();
+        return true;
+    };
+
+    std::unique_ptr<SharedControl> control(new SharedControl(name, static_cast<unsigned>(rigs.size()), handler, source));
+    Logger::info("Local control on shared memory %s", name.c_str());
+    return control;
+}
+
+// home all heads at once before any command arrives, throws if one of them fails
+static void homeRigs(RigRegistry& rigs)
+{
+    std::vector<std::future<std::pair<int, int>>> homing;
+    for(unsigned id = 0; id < rigs.size(); id++)
+        homing.push_back(std::async(std::launch::async, &MotorController::home, rigs.get(id)));
+
+    for(unsigned id = 0; id < homing.size(); id++)
+    {
+        std::pair<int, int> travel = homing[id].get();
+        Logger::info("Rig %u homed, travel pitch %d yaw %d", id, travel.first, travel.second);
+    }
+}
+
+// joystick velocity for both axes of one rig, from udp or a replayed log
+static void applyVelocity(RigRegistry& rigs, unsigned rig, int pitch, int yaw)
+{
+    MotorController* motors = rigs.get(rig);
+    if(!motors)
+        return;
+
+    LatencyMonitor::instance().mark(LatencyMonitor::Dispatch);
+    motors->setPitch(pitch);
+    motors->setYaw(yaw);
+}
+
+// dial out to a central controller and keep the link up
+static void runClient(const po::variables_map& vm, RigRegistry& rigs, Watchdog& deadman,
+                      CommandLog::Recorder* recorder)
+{
+    CommandRouter router(rigs);
+    // a scheduled command counts as one arriving when it runs, so a jog it starts stays guarded
+    router.setOnScheduledRun([&deadman]() { deadman.feed(); });
+    WebSocketClient acs;
+
+    acs.setHeartbeat(std::chrono::milliseconds(vm["heartbeat-interval"].as<unsigned>()),
+                     std::chrono::milliseconds(vm["heartbeat-timeout"].as<unsigned>()));
+    acs.setReconnectBackoff(std::chrono::milliseconds(vm["reconnect-min"].as<unsigned>()),
+                            std::chrono::milliseconds(vm["reconnect-max"].as<unsigned>()));
+    acs.setDialStagger(std::chrono::milliseconds(vm["dial-stagger"].as<unsigned>()));
+    acs.setSendQueue(vm["send-queue"].as<size_t>(), parseDropPolicy(vm["send-policy"].as<std::string>()),
+                     vm["send-high-water"].as<size_t>());
+
+    TelemetryPublisher telemetry(rigs, [&acs](std::shared_ptr<const std::string> frame) {
+        acs.send(std::move(frame), websocketpp::connection_hdl(), websocketpp::frame::opcode::BINARY);
+    }, vm["telemetry-rate"].as<unsigned>());
+
+    Metrics::Gauge queueDepth("rig_send_queue_depth", "Messages waiting to be sent", "",
+                              [&acs]() { return acs.getSendQueueStats().depth; });
+    Metrics::Gauge queueDropped("rig_send_queue_dropped_total", "Messages dropped by the send queue policy", "",
+                                [&acs]() { return acs.getSendQueueStats().dropped; }, true);
+    Metrics::Gauge linkUp("rig_controller_connected", "1 while the controller link is up", "",
+                          [&acs]() { return acs.isConnected() ? 1 : 0; });
+
+    // the rig has no listening socket of its own in client mode, open one just for scrapes
+    std::unique_ptr<WebSocketServer> metrics;
+
+    if(vm["metrics-port"].as<uint16_t>() != 0)
+    {
+        metrics.reset(new WebSocketServer(vm["metrics-port"].as<uint16_t>()));
+        Logger::info("Serving metrics on port %u", vm["metrics-port"].as<uint16_t>());
+    }
+
+    acs.onConnected.connect([&acs, &telemetry]() {
+        Logger::info("Connected to %s", acs.getEndpoint().c_str());
+        // the controller has no baseline yet
+        telemetry.requestKeyframe();
+    });
+
+    acs.onDisconnected.connect([&rigs]() {
+        Logger::warning("Connection lost, stopping all axes");
+        rigs.stop();
+    });
+
+    //mcd.setPitch(rh->message.CameraSettings.motorPitch);
+    //mcd.setYaw(rh->message.CameraSettings.motorYaw);
+
+    const CommandReply reply = [&acs](const std::string& answer) {
+        acs.send(answer);
+    };
+
+    acs.setMessageHandler([&router, &deadman, reply, recorder](const std::string& msg) {
+        if(msg.empty())
+            return;
+
+        deadman.feed();
+        if(recorder)
+            recorder->recordCommand(msg);
+        router.dispatch(msg, reply);
+    });
+
+    // optional joystick stream over udp, control and telemetry stay on the websocket
+    std::unique_ptr<UdpControl> udp;
+
+    if(vm["udp-port"].as<uint16_t>() != 0)
+    {
+        udp.reset(new UdpControl(acs.getIoService(), vm["udp-bind"].as<std::string>(), vm["udp-port"].as<uint16_t>()));
+        udp->onVelocity.connect([&rigs, &deadman, recorder](unsigned rig, int pitch, int yaw) {
+            if(!rigs.get(rig))
+                return;
+
+            deadman.feed();
+            if(recorder)
+                recorder->recordVelocity(rig, pitch, yaw);
+            applyVelocity(rigs, rig, pitch, yaw);
+        });
+        Logger::info("Listening for joystick datagrams on udp port %u", vm["udp-port"].as<uint16_t>());
+    }
+
+    const std::vector<WebSocketClient::Endpoint> endpoints = controllerEndpoints(vm);
+
+    std::unique_ptr<SharedControl> local = startSharedControl(vm, rigs, router, deadman, recorder);
+
+    for(const WebSocketClient::Endpoint& endpoint : endpoints)
+        Logger::info("Trying to connect to %s port %u", endpoint.address.c_str(), endpoint.port);
+    // the client keeps reconnecting on its own from here on
+    if(!acs.connect(endpoints))
+        return;
+
+    waitForShutdown();
+    // answer a running homing while the connection is still there, scheduled commands would answer too late
+    rigs.cancelHoming();
+    router.cancelScheduled();
+}
+
+// host the websocket server on the rig, one operator holds control and everyone watches telemetry
+static void runServer(const po::variables_map& vm, RigRegistry& rigs, Watchdog& deadman,
+                      CommandLog::Recorder* recorder)
+{
+    ControlArbiter arbiter;
+    CommandRouter router(rigs);
+    // a scheduled command counts as one arriving when it runs, so a jog it starts stays guarded
+    router.setOnScheduledRun([&deadman]() { deadman.feed(); });
+    WebSocketServer server(vm["listen-port"].as<uint16_t>());
+    server.setSendQueue(vm["send-queue"].as<size_t>(), parseDropPolicy(vm["send-policy"].as<std::string>()),
+                        vm["send-high-water"].as<size_t>());
+
+    TelemetryPublisher telemetry(rigs, [&server](std::shared_ptr<const std::string> frame) {
+        server.send(std::move(frame), websocketpp::connection_hdl(), websocketpp::frame::opcode::BINARY);
+    }, vm["telemetry-rate"].as<unsigned>());
+
+    Metrics::Gauge queueDepth("rig_send_queue_depth", "Messages waiting to be sent", "",
+                              [&server]() { return server.getSendQueueStats().depth; });
+    Metrics::Gauge queueDropped("rig_send_queue_dropped_total", "Messages dropped by the send queue policy", "",
+                                [&server]() { return server.getSendQueueStats().dropped; }, true);
+    Metrics::Gauge operators("rig_operators_connected", "Open operator connections", "",
+                             [&server]() { return server.getConnectionCount(); });
+
+    arbiter.onHolderChanged.connect([&server, &rigs, &router](unsigned holder) {
+        Logger::info("Control token held by %u", holder);
+        // never let the previous operator's last vector keep running, nor the commands it scheduled
+        router.cancelScheduled();
+        rigs.stop();
+        // only the latest holder matters to a peer that fell behind
+        server.send(std::make_shared<const std::string>("C" + std::to_string(holder)), websocketpp::connection_hdl(),
+                    websocketpp::frame::opcode::TEXT, 'C');
+    });
+
+    server.onConnected.connect([&server, &arbiter, &telemetry](websocketpp::connection_hdl hdl) {
+        unsigned id = arbiter.add(hdl);
+        Logger::info("Operator %u connected", id);
+        server.send("I" + std::to_string(id), hdl);
+        server.send("C" + std::to_string(arbiter.getHolder()), hdl);
+        telemetry.requestKeyframe();
+    });
+
+    server.onDisconnected.connect([&arbiter](websocketpp::connection_hdl hdl) {
+        Logger::info("Operator %u disconnected", arbiter.getId(hdl));
+        arbiter.remove(hdl);
+    });
+
+    server.setMessageHandler([&server, &arbiter, &router, &deadman, recorder](const std::string& msg, websocketpp::connection_hdl hdl) {
+        if(msg.empty())
+            return;
+
+        const CommandReply reply = [&server, hdl](const std::string& answer) {
+            server.send(answer, hdl);
+        };
+
+        switch(msg[0])
+        {
+            case 'l':
+                // statistics are readable by every operator
+                router.dispatch(msg, reply);
+                break;
+            case 'c':
+                if(CommandRouter::parseValue(msg) == 0)
+                    arbiter.release(hdl);
+                else if(!arbiter.claim(hdl, CommandRouter::parseValue(msg) == 2))
+                    server.send("Econtrol held by " + std::to_string(arbiter.getHolder()), hdl);
+                break;
+            case 'h':
+                if(!arbiter.handOff(hdl, CommandRouter::parseValue(msg)))
+                    server.send("Ecannot hand off", hdl);
+                break;
+            default:
+                if(!arbiter.isHolder(hdl))
+                {
+                    server.send("Enot in control", hdl);
+                    break;
+                }
+                deadman.feed();
+                if(recorder)
+                    recorder->recordCommand(msg);
+                router.dispatch(msg, reply);
+                break;
+        }
+    });
+
+    // local processes are trusted, they bypass the control arbitration
+    std::unique_ptr<SharedControl> local = startSharedControl(vm, rigs, router, deadman, recorder);
+
+    Logger::info("Listening on port %u", vm["listen-port"].as<uint16_t>());
+
+    waitForShutdown();
+    // answer a running homing while the connection is still there, scheduled commands would answer too late
+    rigs.cancelHoming();
+    router.cancelScheduled();
+}
+
+// feed a recorded session through the command path, at the recorded pace scaled by speed or as fast as possible
+static void runReplay(const po::variables_map& vm, RigRegistry& rigs, Watchdog& deadman)
+{
+    CommandRouter router(rigs);
+    // recorded "@T:" commands are all late by now, running them on the scheduler thread would only race the replay
+    router.setImmediate(true);
+    CommandLog::Reader reader(vm["replay"].as<std::string>());
+    const double speed = vm["replay-speed"].as<double>();
+
+    const CommandReply reply = [](const std::string& answer) {
+        Logger::debug("Reply %s", answer.c_str());
+    };
+
+    CommandLog::Record record;
+    uint64_t count = 0;
+    const auto start = std::chrono::steady_clock::now();
+
+    while(running && reader.next(record))
+    {
+        if(speed > 0)
+            std::this_thread::sleep_until(start + std::chrono::nanoseconds(static_cast<int64_t>(record.time / speed)));
+
+        // measured like a live command received now
+        LatencyMonitor::CommandScope command;
+        deadman.feed();
+
+        if(record.kind == CommandLog::Command)
+            router.dispatch(record.command, reply);
+        else
+            applyVelocity(rigs, record.rig, record.pitch, record.yaw);
+
+        count++;
+    }
+
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const std::string report = LatencyMonitor::instance().report();
+
+    Logger::info("Replayed %llu commands in %.3f s", static_cast<unsigned long long>(count), elapsed);
+    Logger::info("Latency report\n%.*s", static_cast<int>(report.size()) - 1, report.c_str());
+    rigs.stop();
+}
+
+// replay on the simulated clock of the registry: the motors step through the recorded session as fast as the CPU
+// allows, the dead-man stop is emulated in session time and the end positions are the same on every run
+static void runVirtualReplay(const po::variables_map& vm, RigRegistry& rigs)
+{
+    CommandRouter router(rigs);
+    // recorded "@T:" commands are all late by now, running them on the scheduler thread would only race the replay
+    router.setImmediate(true);
+    CommandLog::Reader reader(vm["replay"].as<std::string>());
+    StepEngine& engine = rigs.getStepEngine();
+    const std::chrono::milliseconds timeout(vm["deadman-timeout"].as<unsigned>());
+
+    const CommandReply reply = [](const std::string& answer) {
+        Logger::debug("Reply %s", answer.c_str());
+    };
+
+    CommandLog::Record record;
+    uint64_t count = 0;
+    const Clock::time_point start = engine.getClock()->now();
+    Clock::time_point last = start;
+    const auto wallStart = std::chrono::steady_clock::now();
+
+    while(running && reader.next(record))
+    {
+        const Clock::time_point due = start + std::chrono::nanoseconds(record.time);
+
+        if(timeout.count() > 0 && due - last > timeout)
+        {
+            engine.runUntil(last + timeout);
+            rigs.stopJogging();
+        }
+
+        engine.runUntil(due);
+        last = due;
+
+        if(record.kind == CommandLog::Command)
+            router.dispatch(record.command, reply);
+        else
+            applyVelocity(rigs, record.rig, record.pitch, record.yaw);
+
+        count++;
+    }
+
+    // the session ends with the last command, let the dead-man stop what is still moving
+    if(timeout.count() > 0)
+        engine.runUntil(last + timeout);
+    rigs.stop();
+
+    const double simulated = std::chrono::duration<double>(engine.getClock()->now() - start).count();
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+    Logger::info("Replayed %llu commands, %.3f s of session time in %.3f s", static_cast<unsigned long long>(count),
+                 simulated, elapsed);
+
+    for(unsigned id = 0; id < rigs.size(); id++)
+    {
+        const RigState state = rigs.get(id)->getState();
+        Logger::info("Rig %u ends at pitch %d, yaw %d half steps", id, state.pitchPosition, state.yawPosition);
+    }
+}
+
 int main(int argc, char **argv) {
     try {
-        MotorController mcd;
+        po::options_description desc("Options");
+        desc.add_options()
+            ("help,h", "Show this help")
+            ("mode", po::value<std::string>()->default_value("client"), "\"client\" dials the controller, \"server\" lets operators connect to the rig, \"replay\" runs a recorded session")
+            ("host", po::value<std::vector<std::string>>()->composing(), "Controller \"HOST[:PORT]\", repeat for standby controllers; all are dialed in parallel, the first to answer wins and a lost link fails over to the next (default 192.168.1.99)")
+            ("port", po::value<uint16_t>()->default_value(9876), "Controller port of hosts given without one")
+            ("dial-stagger", po::value<unsigned>()->default_value(100), "Head start in ms of each controller over the next when dialing, 0 dials all at once")
+            ("listen-port", po::value<uint16_t>()->default_value(9876), "Port for operators in server mode")
+            ("heartbeat-interval", po::value<unsigned>()->default_value(1000), "Ping interval in ms, 0 disables heartbeats")
+            ("heartbeat-timeout", po::value<unsigned>()->default_value(3000), "Drop the link if a ping is not answered within this many ms")
+            ("deadman-timeout", po::value<unsigned>()->default_value(1000), "Stop all axes if no command arrives within this many ms, 0 disables")
+            ("reconnect-min", po::value<unsigned>()->default_value(50), "First reconnect delay in ms")
+            ("reconnect-max", po::value<unsigned>()->default_value(5000), "Maximum reconnect delay in ms")
+            ("udp-port", po::value<uint16_t>()->default_value(0), "Port for joystick velocity datagrams in client mode, 0 disables")
+            ("udp-bind", po::value<std::string>()->default_value("0.0.0.0"), "Address the udp listener binds to")
+            ("telemetry-rate", po::value<unsigned>()->default_value(10), "Telemetry samples per second, 0 disables telemetry")
+            ("send-queue", po::value<size_t>()->default_value(64), "Messages queued per connection before the send policy applies")
+            ("send-policy", po::value<std::string>()->default_value("coalesce"), "Full send queue: \"drop-oldest\", \"drop-newest\" or \"coalesce\"")
+            ("metrics-port", po::value<uint16_t>()->default_value(0), "Port for Prometheus scrapes of /metrics in client mode, 0 disables; server mode serves /metrics on its listen port")
+            ("send-high-water", po::value<size_t>()->default_value(64 * 1024), "Unsent bytes per socket above which messages wait in the send queue")
+            ("config", po::value<std::string>(), "Read further options from this file, one \"name = value\" per line")
+            ("rig", po::value<std::vector<std::string>>()->composing(), "Add a head \"P1,P2,P3,P4:Y1,Y2,Y3,Y4[:LENS[:PMIN,PMAX,YMIN,YMAX[:PB,YB]]]\" with wiringPi pins, lens I2C address, end-stop pins and gear backlash in half steps, empty fields keep their default, repeat for more heads (default 7,0,2,3:22,23,24,25:0x0C)")
+            ("pitch-response", po::value<std::string>()->default_value("0,1,200"), "Pitch response to operator velocity \"DEADBAND,GAMMA,MAXRATE\": share of the stick travel that stands still, exponent of the curve past it and half steps per second at full deflection")
+            ("yaw-response", po::value<std::string>()->default_value("0,1,200"), "Yaw response to operator velocity, see --pitch-response")
+            ("pitch-resonance", po::value<std::string>()->default_value(""), "Pitch step rates \"LOW-HIGH[,LOW-HIGH...]\" in half steps per second the axis never cruises at, a speed inside a band runs at its nearer edge")
+            ("yaw-resonance", po::value<std::string>()->default_value(""), "Yaw step rates the axis never cruises at, see --pitch-resonance")
+            ("track-gains", po::value<std::string>()->default_value("2,0.5,0.05,0.8"), "Visual servo gains \"KP,KI,KD,KFF\" of both axes, in degrees per second per degree of error")
+            ("field-of-view", po::value<double>()->default_value(60.0), "Horizontal field of view of the camera at the widest zoom in degrees")
+            ("zoom-ratio", po::value<double>()->default_value(3.0), "Focal length of the lens at the longest zoom over the widest")
+            ("track-rate", po::value<unsigned>()->default_value(100), "Visual servo loop passes per second")
+            ("home", "Home every head on its end-stops before taking commands")
+            ("preset-file", po::value<std::string>()->default_value("presets.bin"), "Store for named presets, empty keeps them in memory only")
+            ("state-file", po::value<std::string>()->default_value("rig.state"), "Memory-mapped file the axis positions, lens values and calibration survive restarts in, empty disables")
+            ("shm-name", po::value<std::string>()->default_value(""), "POSIX shared memory object for local control, e.g. /rig-control, empty disables")
+            ("record", po::value<std::string>(), "Append every inbound command to this binary log")
+            ("replay", po::value<std::string>(), "Command log to run in replay mode")
+            ("replay-speed", po::value<double>()->default_value(1.0), "Replay pace, 1 is real time, 0 as fast as possible")
+            ("virtual-time", "Replay on a simulated clock, the motors step through the session without waiting")
+            ("trace", po::value<std::string>(), "Record timing spans and write them as Chrome trace-event JSON to this file on exit")
+            ("log-level", po::value<std::string>()->default_value("info"), "\"debug\" also logs every command, \"info\", \"warning\", \"error\" or \"off\"");
+
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+
+        // the command line wins over the file, rigs from both are combined
+        if (vm.count("config")) {
+            std::ifstream config(vm["config"].as<std::string>());
+            if (!config) {
+                std::cerr << "Cannot read config file " << vm["config"].as<std::string>() << std::endl;
+                return 1;
+            }
+            po::store(po::parse_config_file(config, desc), vm);
+        }
+
+        po::notify(vm);
+
+        if (vm.count("help")) {
+            std::cout << desc << std::endl;
+            return 0;
+        }
+
+        Logger::instance().setLevel(Logger::parseLevel(vm["log-level"].as<std::string>()));
+        Trace::setEnabled(vm.count("trace") > 0);
+
+        const std::string mode = vm["mode"].as<std::string>();
+
+        if (mode != "client" && mode != "server" && mode != "replay") {
+            std::cerr << "Unknown mode " << mode << std::endl;
+            return 1;
+        }
 
-        WebSocketClient acs;
+        if (mode == "replay" && !vm.count("replay")) {
+            std::cerr << "Replay mode needs --replay FILE" << std::endl;
+            return 1;
+        }
+
+        std::vector<RigConfig> configs;
+
+        if (vm.count("rig")) {
+            for (auto &spec : vm["rig"].as<std::vector<std::string>>())
+                configs.push_back(RigRegistry::parseRig(spec));
+        } else {
+            configs.push_back(RigRegistry::defaultRig());
+        }
+
+        Tracker::Config tracking = trackingConfig(vm);
+        const std::array<ResponseCurve::Shape, 2> response = {responseShape(vm, "pitch-response"),
+                                                              responseShape(vm, "yaw-response")};
+        const std::array<std::vector<ResponseCurve::Band>, 2> resonance = {
+                resonanceBands(vm, "pitch-resonance", response[0]), resonanceBands(vm, "yaw-resonance", response[1])};
+        for (auto &config : configs) {
+            config.tracking = tracking;
+            config.response = response;
+            config.resonance = resonance;
+        }
+
+        // simulated motion only makes sense for a replay, live commands arrive in wall clock time
+        const bool virtualTime = mode == "replay" && vm.count("virtual-time");
+
+        RigRegistry rigs(configs, virtualTime ? std::make_shared<SimulatedClock>() : Clock::system());
+
+        Metrics::Gauge rigCount("rig_heads", "Pan/tilt heads driven by this process", "",
+                                [&rigs]() { return rigs.size(); });
+        Metrics::Gauge logDropped("rig_log_messages_dropped_total", "Log messages lost because the logger fell behind",
+                                  "", []() { return Logger::instance().getDropped(); }, true);
+        Logger::info("Driving %zu rig(s)", rigs.size());
+
+        // presets written during a replay must not overwrite the ones operators saved
+        if (mode != "replay" && !vm["preset-file"].as<std::string>().empty()) {
+            rigs.getPresets().open(vm["preset-file"].as<std::string>());
+        }
+
+        // a replay starts from zero and must not move the positions of the live rig
+        if (mode != "replay" && !vm["state-file"].as<std::string>().empty()) {
+            rigs.openState(vm["state-file"].as<std::string>());
+        }
+
+        if (vm.count("home")) {
+            if (virtualTime) {
+                std::cerr << "Homing waits for real end-stops, it does not work with --virtual-time" << std::endl;
+                return 1;
+            }
+            homeRigs(rigs);
+        }
+
+        // dead-man stop: zero all jogged axes when the controller goes quiet, a preset move ends on its own
+        Watchdog deadman(std::chrono::milliseconds(vm["deadman-timeout"].as<unsigned>()), [&rigs]() {
+            Logger::warning("No command received, stopping all axes");
+            rigs.stopJogging();
+        });
 
         std::cout << "Websocket Protocol:" << std::endl;
         std::cout << "-----------------------------------------------------" << std::endl;
@@ -34,75 +690,57 @@ int main(int argc, char **argv) {
         std::cout << "\"fX\"    - Focus   X = 0 - stop, 1 - left, 2 - right" << std::endl;
         std::cout << "\"zX\"    - Zoom    X = 0 - stop, 1 - left, 2 - right" << std::endl;
         std::cout << "\"iX\"    - IR Cut  X = 0 - off, 1 - on" << std::endl;
+        std::cout << "\"sNAME\" - Save the current shot as preset NAME (letters, digits, _ and -)" << std::endl;
+        std::cout << "\"gNAME\" - Go to preset NAME, all axes move at once" << std::endl;
+        std::cout << "\"dNAME\" - Delete preset NAME" << std::endl;
+        std::cout << "\"tX,Y\"  - Track the subject at offset X,Y from the frame centre in 1/1000 of half the frame width, \"t\" stops" << std::endl;
+        std::cout << "\"H\"     - Home on the end-stops, replies \"HP,Y\" with the travel in half steps" << std::endl;
+        std::cout << "\"@T:...\" - Run the command at T, CLOCK_REALTIME microseconds since 1970, for synchronized multi-rig moves" << std::endl;
+        std::cout << "\"N:...\" - Send the command to rig N, rig 0 without prefix" << std::endl;
+        std::cout << "\"lX\"    - Latency report X = 0 - keep, 1 - reset afterwards (also on SIGUSR1)" << std::endl;
+        if (mode == "server") {
+            std::cout << "\"cX\"    - Control X = 0 - release, 1 - claim, 2 - take over" << std::endl;
+            std::cout << "\"hX\"    - Hand off control to operator X" << std::endl;
+            std::cout << "Replies: \"IX\" your id, \"CX\" holder id (0 = free), \"E...\" error" << std::endl;
+        }
+        std::cout << "UDP: 7 byte datagrams 'J', u32 sequence (big endian), int8 pitch, int8 yaw, optional u8 rig" << std::endl;
+        std::cout << "Telemetry: binary \"T\" frames per rig with changed fields only" << std::endl;
         std::cout << "-----------------------------------------------------" << std::endl;
+        std::cout << "Moving axes stop unless a command arrives every "
+                  << vm["deadman-timeout"].as<unsigned>() << " ms" << std::endl;
 
-        std::cout << "Trying to connect to 192.168.1.99:9876" << std::endl;
-        // try connect
-        while(!acs.connect("192.168.1.99", 9876) && running)
-            std::this_thread::sleep_for(std::chrono::seconds(3));
-
-        //mcd.setPitch(rh->message.CameraSettings.motorPitch);
-        //mcd.setYaw(rh->message.CameraSettings.motorYaw);
-
-        acs.onMessage.connect([&mcd](const std::string& msg){
-            if(msg.empty())
-                return;
+        signal(SIGINT, on_close);
+        signal(SIGUSR1, on_dump);
 
-            char code = msg[0];
-            int value = 0;
+        if (virtualTime) {
+            runVirtualReplay(vm, rigs);
+        } else if (mode == "replay") {
+            runReplay(vm, rigs, deadman);
+        } else {
+            std::unique_ptr<CommandLog::Recorder> recorder;
 
-            try
-            {
-                value = std::stoi(msg.substr(1));
-            }
-            catch(const std::exception& e)
-            {
-                std::cerr << "Exception: " << e.what() << std::endl;
+            if (vm.count("record")) {
+                recorder.reset(new CommandLog::Recorder(vm["record"].as<std::string>()));
+                Logger::info("Recording commands to %s", vm["record"].as<std::string>().c_str());
             }
 
-            switch(code)
-            {
-                case 'p':// 0 - 200 = [-100,100]
-                    std::cout << "setting Pitch " << value << std::endl;
-                    mcd.setPitch(value);
-                    break;
-                case 'y': // 0 - 200 = [-100,100]
-                    std::cout << "setting Yaw " << value << std::endl;
-                    mcd.setYaw(value);
-                    break;
-                case 'f':
-                    std::cout << "setting Focus " << ((value == 0) ? "stop" : ((value == 1) ? "left" : "right")) << std::endl;
-                    if(value == 0)
-                        mcd.setFocus(0);
-                    else if(value == 1)
-                        mcd.setFocus(100);
-                    else if(value == 2)
-                        mcd.setFocus(-100);
-                    break;
-                case 'z':
-                    std::cout << "setting Zoom " << ((value == 0) ? "stop" : ((value == 1) ? "left" : "right")) << std::endl;
-                    if(value == 0)
-                        mcd.setZoom(0);
-                    else if(value == 1)
-                        mcd.setZoom(100);
-                    else if(value == 2)
-                        mcd.setZoom(-100);
-                    break;
-                case 'i':
-                    std::cout << "setting IR " << value << std::endl;
-                    mcd.setIR(value > 0);
-                    break;
-            }
-        });
+            if (mode == "server")
+                runServer(vm, rigs, deadman, recorder.get());
+            else
+                runClient(vm, rigs, deadman, recorder.get());
 
-        signal(SIGINT, on_close);
+            if (recorder)
+                Logger::info("Recorded %llu commands", static_cast<unsigned long long>(recorder->getRecords()));
+        }
 
-        // loop until shutdown
-        while(running)
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        if (vm.count("trace")) {
+            Trace::setEnabled(false);
+            Trace::save(vm["trace"].as<std::string>());
+            Logger::info("Trace written to %s", vm["trace"].as<std::string>().c_str());
+        }
 
     } catch (const std::exception &e) {
-        std::cerr << "Error: " << e.what() << "\n";
+        Logger::error("Error: %s", e.what());
     }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,286 @@
+// Motion, response curve and state file checks on a simulated clock and the fake GPIO, run by ctest. Exits non-zero
+// if any check fails.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Clock.hpp"
+#include "Gpio.hpp"
+#include "PersistentState.hpp"
+#include "ResponseCurve.hpp"
+#include "StepEngine.hpp"
+#include "StepperMotor.hpp"
+
+#if RASPI == 1
+#error "the motor checks read the coils back from the fake GPIO"
+#endif
+
+static const int Coils[4] = {1, 2, 3, 4};
+
+// 28BYJ48 half step sequence, as driven by StepperMotor
+static const int Sequence[8][4] =
+{
+    {1, 0, 0, 0},
+    {1, 1, 0, 0},
+    {0, 1, 0, 0},
+    {0, 1, 1, 0},
+    {0, 0, 1, 0},
+    {0, 0, 1, 1},
+    {0, 0, 0, 1},
+    {1, 0, 0, 1}
+};
+
+static int failures = 0;
+
+static void check(bool condition, const std::string& what)
+{
+    if(!condition)
+    {
+        std::cerr << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+// Index of the phase the coils hold, -1 if they are released
+static int coilPhase()
+{
+    for(int phase = 0; phase < 8; phase++)
+    {
+        bool match = true;
+        for(int coil = 0; coil < 4; coil++)
+            match = match && digitalRead(Coils[coil]) == Sequence[phase][coil];
+        if(match)
+            return phase;
+    }
+    return -1;
+}
+
+// Jog at vector until the position moved by count half steps, the coils stay energized
+static void jog(StepperMotor& motor, StepEngine& engine, SimulatedClock& clock, int vector, int count)
+{
+    int target = motor.getStepPosition() + (vector > 0 ? count : -count);
+    motor.run_async(vector);
+
+    // 1 ms slices against 5 ms steps, the next step is never taken before the check sees the target
+    for(int slice = 0; slice < count * 10 && motor.getStepPosition() != target; slice++)
+        engine.runUntil(clock.now() + std::chrono::milliseconds(1));
+
+    check(motor.getStepPosition() == target, "jog reaches " + std::to_string(target));
+}
+
+// Forward, reverse, forward: the coils have to hold the same phase whenever the counted position is the same,
+// otherwise every reversal slips the count against the rotor
+static void reversalKeepsPhase()
+{
+    auto clock = std::make_shared<SimulatedClock>();
+    StepEngine engine(clock);
+    auto motor = std::make_shared<StepperMotor>();
+    motor->setGPIOutputs(Coils[0], Coils[1], Coils[2], Coils[3]);
+    engine.add(motor);
+
+    const int moves[] = {8, -5, 3, -11, 2, -1, 1};
+    int offset = -1;
+
+    for(int move : moves)
+    {
+        jog(*motor, engine, *clock, move > 0 ? 100 : -100, std::abs(move));
+
+        int phase = coilPhase();
+        check(phase >= 0, "coils hold a phase while moving");
+
+        int relative = ((phase - motor->getStepPosition()) % 8 + 8) % 8;
+        if(offset < 0)
+            offset = relative;
+        check(relative == offset, "coil phase " + std::to_string(phase) + " matches position " +
+                                  std::to_string(motor->getStepPosition()));
+    }
+
+    motor->run_async(0);
+    engine.runUntil(clock->now() + std::chrono::milliseconds(10));
+    check(coilPhase() == -1, "stop releases the coils");
+    engine.remove(motor);
+}
+
+// Run until the coils hold phase, at most limit milliseconds
+static void runToPhase(StepEngine& engine, SimulatedClock& clock, int phase, int limit)
+{
+    for(int slice = 0; slice < limit && coilPhase() != phase; slice++)
+        engine.runUntil(clock.now() + std::chrono::milliseconds(1));
+}
+
+// Backlash: after a reversal the rotor turns through the slack at full speed before the position counts again,
+// reversing part way through only has to undo what was taken up so far
+static void backlashTakeUp()
+{
+    auto clock = std::make_shared<SimulatedClock>();
+    StepEngine engine(clock);
+    auto motor = std::make_shared<StepperMotor>();
+    motor->setGPIOutputs(Coils[0], Coils[1], Coils[2], Coils[3]);
+    motor->setBacklash(6);
+    engine.add(motor);
+
+    jog(*motor, engine, *clock, 100, 4);
+    const int position = motor->getStepPosition();
+    const int phase = coilPhase();
+
+    // 50 ms per counted step, the six take-up steps at 5 ms are done well before the first counted one
+    motor->run_async(-10);
+    engine.runUntil(clock->now() + std::chrono::milliseconds(40));
+    check(motor->getStepPosition() == position, "take-up leaves the position alone");
+    check(coilPhase() == (phase + 8 - 6) % 8, "take-up turns the rotor through the backlash at full speed");
+
+    jog(*motor, engine, *clock, -100, 2);
+    check(coilPhase() == phase, "counted steps follow the take-up");
+
+    // back again, but only half way through the slack
+    motor->run_async(100);
+    runToPhase(engine, *clock, (phase + 3) % 8, 50);
+    check(coilPhase() == (phase + 3) % 8 && motor->getStepPosition() == position - 2,
+          "a second reversal takes up again without counting");
+
+    // only the three steps taken up go back before the position counts again
+    motor->run_async(-100);
+    runToPhase(engine, *clock, (phase + 8 - 1) % 8, 50);
+    check(coilPhase() == (phase + 8 - 1) % 8 && motor->getStepPosition() == position - 3,
+          "reversing part way undoes only what was taken up");
+
+    motor->run_async(0);
+    engine.runUntil(clock->now() + std::chrono::milliseconds(10));
+    engine.remove(motor);
+}
+
+// Deadband and gamma: the stick centre stands still, the rate never falls as the stick moves out and full
+// deflection reaches the max rate
+static void responseTable()
+{
+    ResponseCurve::Shape shape;
+    shape.deadband = 0.1;
+    shape.gamma = 2.0;
+    shape.maxRate = 400.0;
+    ResponseCurve curve(shape);
+
+    for(int vector = -10; vector <= 10; vector++)
+        check(curve.interval(vector) == 0, "vector " + std::to_string(vector) + " inside the deadband stands still");
+
+    for(int vector = 11; vector <= ResponseCurve::MaxVector; vector++)
+    {
+        check(curve.interval(vector) > 0, "vector " + std::to_string(vector) + " past the deadband moves");
+        check(curve.interval(-vector) == curve.interval(vector), "vector " + std::to_string(vector) + " is symmetric");
+        if(vector > 11)
+            check(curve.interval(vector) <= curve.interval(vector - 1), "vector " + std::to_string(vector) +
+                                                                        " is not slower than the one before");
+    }
+
+    check(curve.interval(ResponseCurve::MaxVector) == 2500, "full deflection runs at the max rate");
+    check(curve.interval(ResponseCurve::MaxVector + 50) == 2500, "vectors beyond full deflection clamp");
+    // half way from the deadband to full deflection, gamma 2 gives a quarter of the max rate
+    check(curve.interval(55) == 10000, "gamma 2 runs at a quarter of the max rate half way out");
+}
+
+// Bands with less than a whole interval between them: a rate rounded out of one must not land inside the other,
+// while the gap of a whole interval between two others stays usable
+static void adjacentBandsStayClear()
+{
+    const std::vector<ResponseCurve::Band> bands = {{60.0, 80.0001}, {80.0005, 95.0}, {100.0, 150.0},
+                                                    {150.001, 170.0}};
+    ResponseCurve curve(ResponseCurve::linear(), bands);
+
+    check(curve.getBands().size() == 2, "bands without a whole interval between them merge");
+
+    for(int vector = 1; vector <= ResponseCurve::MaxVector; vector++)
+    {
+        double rate = 1e6 / curve.interval(vector);
+        for(const ResponseCurve::Band& band : bands)
+            check(rate <= band.low || rate >= band.high, "vector " + std::to_string(vector) + " runs at " +
+                                                         std::to_string(rate) + " inside a band");
+    }
+    check(1e6 / curve.interval(48) > 95.0 && 1e6 / curve.interval(48) < 100.0, "the gap between bands stays usable");
+}
+
+// Overwrite one byte of the state file at offset, as a torn write or a flipped bit would
+static void damageState(const std::string& path, off_t offset, uint8_t value)
+{
+    int fd = open(path.c_str(), O_WRONLY);
+    check(fd >= 0 && pwrite(fd, &value, 1, offset) == 1, "state file can be damaged");
+    if(fd >= 0)
+        close(fd);
+}
+
+static std::vector<PersistentState::Rig> loadState(const std::string& path)
+{
+    PersistentState state;
+    state.open(path);
+    return state.load();
+}
+
+// A slot that is torn or fails its checksum is skipped, the other slot with the snapshot before still resumes
+static void stateFallsBack()
+{
+    char name[] = "/tmp/rigStateTestXXXXXX";
+    int fd = mkstemp(name);
+    check(fd >= 0, "temporary state file");
+    if(fd < 0)
+        return;
+    close(fd);
+    const std::string path = name;
+
+    // layout of PersistentState: 64 byte header, then two slots of 16 + 40 * MaxRigs bytes
+    const off_t slotSize = 16 + 40 * PersistentState::MaxRigs;
+    const off_t slot0 = 64;
+
+    PersistentState::Rig rig = {};
+    {
+        PersistentState state;
+        state.open(path);
+        rig.pitchPosition = 100;
+        state.store({rig});     // sequence 1, goes to slot 1
+        rig.pitchPosition = 200;
+        state.store({rig});     // sequence 2, goes to slot 0
+    }
+
+    std::vector<PersistentState::Rig> rigs = loadState(path);
+    check(rigs.size() == 1 && rigs[0].pitchPosition == 200, "the newest snapshot resumes");
+
+    // a flipped bit in the records of the newest slot fails its checksum
+    damageState(path, slot0 + 16, 0x5A);
+    rigs = loadState(path);
+    check(rigs.size() == 1 && rigs[0].pitchPosition == 100, "a slot failing its checksum falls back to the other");
+
+    // sequence 0 is a slot the writer had started on and not finished
+    {
+        PersistentState state;
+        state.open(path);
+        rig.pitchPosition = 300;
+        state.store({rig});     // sequence 2 again, into the damaged slot 0
+    }
+    for(off_t byte = 0; byte < 8; byte++)
+        damageState(path, slot0 + byte, 0);
+    rigs = loadState(path);
+    check(rigs.size() == 1 && rigs[0].pitchPosition == 100, "a torn slot falls back to the other");
+
+    // with both slots unusable nothing is resumed
+    damageState(path, slot0 + slotSize + 16, 0x5A);
+    check(loadState(path).empty(), "no intact slot resumes nothing");
+
+    unlink(name);
+}
+
+int main()
+{
+    reversalKeepsPhase();
+    backlashTakeUp();
+    responseTable();
+    adjacentBandsStayClear();
+    stateFallsBack();
+
+    if(failures == 0)
+        std::cout << "all motor checks passed" << std::endl;
+    return failures == 0 ? 0 : 1;
+}